@@ -1,4 +1,4 @@
-from flask import Flask, render_template, request, redirect, url_for, send_file, send_from_directory
+from flask import Flask, render_template, request, redirect, url_for, send_file, send_from_directory, jsonify, abort
 import os #Needed for the GUI portion 
 import argparse
 import subprocess #Needed to call on the C program
@@ -9,6 +9,9 @@ from datetime import date, datetime
 import time
 from plotly import graph_objs as go
 import numpy as np
+import uuid
+from jobqueue import JobQueue, QueueFull
+from tiles import read_tiles
 
 output_file=""
 if not os.path.exists('uploads'):
@@ -22,6 +25,10 @@ ALLOWED_EXTENSIONS = {'txt', 'fasta'}
 app = Flask(__name__)
 app.config['UPLOAD_FOLDER'] = UPLOAD_FOLDER
 
+# uploads are scored in the background, ZHUNT_WORKERS=0 leaves it to `python jobqueue.py`
+queue = JobQueue(os.path.join(UPLOAD_FOLDER, 'queue'))
+queue.start_workers()
+
 def allowed_file(filename):
     return '.' in filename and \
            filename.rsplit('.', 1)[1].lower() in ALLOWED_EXTENSIONS
@@ -39,17 +46,18 @@ def upload_file():
             flash('No selected file')
             return redirect(request.url)
         if file and allowed_file(file.filename):
-            filename = secure_filename(file.filename)
+            # uploads of the same name must not overwrite each other
+            filename = uuid.uuid4().hex[:8] + "_" + secure_filename(file.filename)
             file.save(os.path.join(app.config['UPLOAD_FOLDER'], filename))
-            
+
             email=request.form.get("user_email")
-            command_line = "zhunt 12 6 12 ./uploads/" + filename
-        
-            stream=os.popen(command_line)
-            output=stream.read()
-            output
-                        
-            output_file="/uploads/"+filename+".Z-SCORE"
+            try:
+                upload = "./uploads/" + filename
+                job_id = queue.submit(email, upload, ["--tiles", upload + ".tiles", "12", "6", "12"])
+            except QueueFull as error:
+                os.remove(os.path.join(app.config['UPLOAD_FOLDER'], filename))
+                return render_template("job.html", state="refused", message=str(error)), 503
+
             user_info=open(os.getcwd()+'/uploads/users.txt','a')
             now=datetime.now()
             now=str(now)
@@ -61,10 +69,64 @@ def upload_file():
             for document in os.listdir('./templates/'):
                 if document.endswith('figure.html'):
                     os.remove('./templates/' + document)
-            
-            return render_template("downloads.html", output_file=output_file)
+
+            return redirect(url_for('job_page', job_id=job_id))
     return render_template("index.html")
 
+@app.route('/status/<job_id>')
+def job_status(job_id):
+    job = queue.status(job_id)
+    if job is None:
+        abort(404)
+    return jsonify({key: job.get(key) for key in ('id', 'state', 'position', 'submitted', 'started', 'finished', 'threads', 'partial')})
+
+@app.route('/cancel/<job_id>', methods=['POST'])
+def job_cancel(job_id):
+    """drops a waiting job; a running one stops and keeps what it has scored"""
+    if queue.cancel(job_id) is None:
+        abort(404)
+    return redirect(url_for('job_page', job_id=job_id))
+
+@app.route('/job/<job_id>')
+def job_page(job_id):
+    job = queue.status(job_id)
+    if job is None:
+        abort(404)
+    if job['state'] == 'done':
+        return render_template("downloads.html", output_file=job['upload'][1:] + ".Z-SCORE", job_id=job_id, partial=job.get('partial'))
+    return render_template("job.html", state=job['state'], position=job.get('position'), message=job.get('error'), job_id=job_id)
+
+# Zooming the plot fetches the tiles of the visible range again
+TILES_SCRIPT = """
+var plot = document.getElementById('{plot_id}');
+plot.on('plotly_relayout', function(event) {
+    var query = '';
+    if (event['xaxis.range[0]'] !== undefined) {
+        query = '?start=' + Math.max(0, Math.floor(event['xaxis.range[0]'])) + '&end=' + Math.ceil(event['xaxis.range[1]']);
+    } else if (!event['xaxis.autorange']) {
+        return;
+    }
+    fetch('TILES_URL' + query).then(function(response) { return response.json(); }).then(function(tiles) {
+        var p = tiles.probability;
+        Plotly.restyle(plot, {x: [tiles.start, tiles.start, tiles.start], y: [p.min, p.max, p.mean]}, [0, 1, 2]);
+    });
+});
+"""
+PLOT_BINS = 2000
+
+@app.route('/tiles/<job_id>')
+def job_tiles(job_id):
+    """min/max/mean dl and probability over ?start=&end= in at most ?bins= bins"""
+    job = queue.status(job_id)
+    if job is None or job['state'] != 'done' or not os.path.exists(job['upload'] + ".tiles"):
+        abort(404)
+    try:
+        return jsonify(read_tiles(job['upload'] + ".tiles", request.args.get('start', 0, type=int),
+                                  request.args.get('end', None, type=int), request.args.get('bins', PLOT_BINS, type=int),
+                                  request.args.get('section', 0, type=int)))
+    except (IndexError, ValueError):
+        abort(400)
+
 @app.route('/return-file/', methods=['get','post'])
 def downloadFile ():
     filename = request.form['download_output_file']
@@ -74,11 +136,22 @@ def downloadFile ():
 @app.route('/see_graph/', methods=['get','post'])
 def see_data ():
     filename = request.form['output_file']
+    run_filename= filename[8:] + "_figure.html"
+    job = queue.status(request.form.get('job_id', ''))
+    if job is not None and os.path.exists(job['upload'] + ".tiles"):
+        # a band from the smallest to the largest value of each bin, and the mean
+        tiles = read_tiles(job['upload'] + ".tiles", bins=PLOT_BINS)
+        p = tiles['probability']
+        fig = go.Figure(data=[go.Scatter(x=tiles['start'], y=p['min'], line_shape="hv", line_width=0, showlegend=False, hoverinfo="skip"),
+                              go.Scatter(x=tiles['start'], y=p['max'], line_shape="hv", line_width=0, fill="tonexty", fillcolor="rgba(19,89,194,0.3)", name="min-max"),
+                              go.Scatter(x=tiles['start'], y=p['mean'], line_shape="hv", line_color="#1359c2", name="mean")])
+        fig.update_layout(xaxis=dict(title=tiles['name']),yaxis=dict(title="Z-SCORE"))
+        fig.write_html('./templates'+run_filename, post_script=TILES_SCRIPT.replace('TILES_URL', url_for('job_tiles', job_id=job['id'])))
+        return render_template(run_filename)
     df_file="."+filename
     df=np.loadtxt(df_file, skiprows=1, usecols=[2],dtype=str)
     fig = go.Figure(data=go.Bar(y=df, marker_color="#1359c2"))
     fig.update_layout(xaxis=dict(title="Sequence"),yaxis=dict(title="Z-SCORE"))
-    run_filename= filename[8:] + "_figure.html"
     fig.write_html('./templates'+run_filename)
     return render_template(run_filename)
 
@@ -0,0 +1,169 @@
+/*
+Microbenchmarks of the per-window kernels across window sizes.
+Prints one JSON object with the best-of-N time per call of each kernel.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "antisyn.h"
+#include "delta_linking.h"
+#include "instrument.h"
+#include "sequence.h"
+#include "zscore.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static volatile double sink;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void random_bases(char* seq, size_t n, unsigned* state)
+{
+    static const char bases[] = "atgc";
+    for (size_t i = 0; i < n; i++) {
+        *state = *state * 1103515245u + 12345u;
+        seq[i] = bases[(*state >> 16) & 3];
+    }
+}
+
+static void report(int* first, const char* kernel, int din, double ns)
+{
+    printf("%s    {\"kernel\": \"%s\", \"din\": %d, \"ns_per_call\": %.2f}", *first ? "" : ",\n", kernel, din, ns);
+    *first = 0;
+}
+
+/* best of 'repeat' timings of BODY run over all windows, in ns per window */
+#define TIME_KERNEL(best, repeat, windows, BODY)           \
+    do {                                                   \
+        best = INFINITY;                                   \
+        for (int r_ = 0; r_ < (repeat); r_++) {            \
+            double t0_ = now_ns();                         \
+            for (int w = 0; w < (windows); w++) {          \
+                BODY;                                      \
+            }                                              \
+            double t_ = (now_ns() - t0_) / (windows);      \
+            if (t_ < best) {                               \
+                best = t_;                                 \
+            }                                              \
+        }                                                  \
+    } while (0)
+
+static void usage(void)
+{
+    printf("usage: bench_kernels [--min din] [--max din] [--windows n] [--repeat n]\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option longopts[] = {
+        { "min", required_argument, NULL, 'm' },
+        { "max", required_argument, NULL, 'M' },
+        { "windows", required_argument, NULL, 'w' },
+        { "repeat", required_argument, NULL, 'r' },
+        { NULL, 0, NULL, 0 }
+    };
+    int mindin = 6, maxdin = 24, windows = 2048, repeat = 5;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'm':
+            mindin = atoi(optarg);
+            break;
+        case 'M':
+            maxdin = atoi(optarg);
+            break;
+        case 'w':
+            windows = atoi(optarg);
+            break;
+        case 'r':
+            repeat = atoi(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (mindin < 1 || maxdin < mindin || windows < 1 || repeat < 1) {
+        usage();
+    }
+
+    const double a = 0.357 / 2.0;
+    const int nucleotides = 2 * maxdin;
+    unsigned state = 12345;
+
+    antisyn_init();
+    delta_linking_init(maxdin);
+    INSTRUMENT_INIT();
+
+    char* seq = (char*)malloc((size_t)windows * nucleotides);
+    random_bases(seq, (size_t)windows * nucleotides, &state);
+    bzindex_t* bzindex = (bzindex_t*)malloc((size_t)windows * maxdin);
+    char* antisyn = (char*)malloc((size_t)windows * (nucleotides + 1));
+    double* bzenergy = (double*)malloc((size_t)windows * maxdin * sizeof(double));
+    double* logcoef = (double*)malloc((size_t)windows * maxdin * sizeof(double));
+    double* dl = (double*)malloc((size_t)windows * sizeof(double));
+    Result result;
+    result.antisyn = (char*)malloc(nucleotides + 1);
+
+    printf("{\n  \"kernels\": [\n");
+    int first = 1;
+    double best;
+    for (int din = mindin; din <= maxdin; din++) {
+        TIME_KERNEL(best, repeat, windows, assign_bzenergy_index(2 * din, seq + (size_t)w * nucleotides, bzindex + (size_t)w * maxdin));
+        report(&first, "assign_bzenergy_index", din, best);
+
+        TIME_KERNEL(best, repeat, windows, find_best_antisyn(din, bzindex + (size_t)w * maxdin, antisyn + (size_t)w * (nucleotides + 1)));
+        report(&first, "find_best_antisyn", din, best);
+
+        TIME_KERNEL(best, repeat, windows, antisyn_bzenergy(din, antisyn + (size_t)w * (nucleotides + 1), bzindex + (size_t)w * maxdin, bzenergy + (size_t)w * maxdin));
+        report(&first, "antisyn_bzenergy", din, best);
+
+        TIME_KERNEL(best, repeat, windows, delta_linking_logcoef(din, bzenergy + (size_t)w * maxdin, logcoef + (size_t)w * maxdin));
+        report(&first, "delta_linking_logcoef", din, best);
+
+        TIME_KERNEL(best, repeat, windows, dl[w] = find_delta_linking(din, a * din, logcoef + (size_t)w * maxdin));
+        report(&first, "find_delta_linking", din, best);
+
+        TIME_KERNEL(best, repeat, windows, sink = delta_linking_slope(dl[w], logcoef + (size_t)w * maxdin, din));
+        report(&first, "delta_linking_slope", din, best);
+
+        TIME_KERNEL(best, repeat, windows, sink = assign_probability(dl[w]));
+        report(&first, "assign_probability", din, best);
+
+        TIME_KERNEL(best, repeat, windows / 8 + 1, zscore_window(bzindex + (size_t)w * maxdin, a, mindin, din, &result));
+        report(&first, "zscore_window", din, best);
+    }
+
+    /* packing and frame building, per base */
+    size_t nbases = (size_t)windows * nucleotides;
+    TIME_KERNEL(best, repeat, 1, {
+        Sequence* packed = sequence_new();
+        sequence_append(packed, seq, nbases);
+        sequence_finish(packed, nucleotides);
+        sequence_free(packed);
+    });
+    report(&first, "sequence_ingest_per_base", 0, best / nbases);
+    printf("\n  ]\n}\n");
+
+    free(result.antisyn);
+    free(dl);
+    free(logcoef);
+    free(bzenergy);
+    free(antisyn);
+    free(bzindex);
+    free(seq);
+    delta_linking_destroy();
+    antisyn_destroy();
+    INSTRUMENT_DUMP();
+    return 0;
+}
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Compare two run_bench.py reports and flag regressions.
+
+Every kernel (by name and din) and end-to-end run (by size and threads)
+present in both reports is compared; a measurement more than --threshold
+slower in the new report is a regression, and the exit status is 1 if
+there is any.
+"""
+
+import argparse
+import json
+import sys
+
+
+def index(report):
+    entries = {}
+    for k in report.get("kernels", []):
+        entries[("kernel", k["kernel"], k["din"])] = k["ns_per_call"]
+    for e in report.get("end_to_end", []):
+        entries[("end_to_end", e["size"], e["threads"])] = e["seconds"]
+    return entries
+
+
+def describe(key):
+    if key[0] == "kernel":
+        return "%s din=%d" % (key[1], key[2])
+    return "end-to-end size=%d threads=%d" % (key[1], key[2])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("old")
+    parser.add_argument("new")
+    parser.add_argument("--threshold", type=float, default=0.05,
+                        help="relative slowdown flagged as a regression (default 0.05)")
+    parser.add_argument("--all", action="store_true", help="print every comparison, not only changes")
+    args = parser.parse_args()
+
+    with open(args.old) as f:
+        old = index(json.load(f))
+    with open(args.new) as f:
+        new = index(json.load(f))
+
+    regressions = 0
+    for key in sorted(set(old) & set(new), key=str):
+        if old[key] <= 0:
+            continue
+        ratio = new[key] / old[key]
+        if ratio > 1.0 + args.threshold:
+            status = "REGRESSION"
+            regressions += 1
+        elif ratio < 1.0 - args.threshold:
+            status = "improved"
+        elif args.all:
+            status = "same"
+        else:
+            continue
+        print("%-10s %-45s %12.4g -> %12.4g (%+.1f%%)" % (status, describe(key), old[key], new[key], 100.0 * (ratio - 1.0)))
+
+    missing = set(old) ^ set(new)
+    if missing:
+        print("%d measurements present in only one report" % len(missing))
+    print("%d regressions" % regressions)
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
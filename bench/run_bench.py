@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""Benchmark suite for zhunt.
+
+Runs the kernel microbenchmarks (bench_kernels) and end-to-end zhunt runs on
+synthetic sequences over a range of sizes and thread counts, and writes all
+timings as one JSON document for bench/compare.py.
+"""
+
+import argparse
+import json
+import os
+import platform
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def parse_list(text, kind=int):
+    return [kind(float(x)) for x in text.split(",") if x]
+
+
+def cpu_model():
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    return line.split(":", 1)[1].strip()
+    except OSError:
+        pass
+    return platform.processor()
+
+
+def synthetic_fasta(path, size, seed):
+    rng = random.Random(seed)
+    with open(path, "w") as f:
+        f.write(">synthetic_%d\n" % size)
+        remaining = size
+        while remaining > 0:
+            n = min(remaining, 1 << 20)
+            block = "".join(rng.choices("acgt", k=n))
+            for i in range(0, n, 60):
+                f.write(block[i:i + 60])
+                f.write("\n")
+            remaining -= n
+
+
+def run_kernels(binary, args):
+    cmd = [binary, "--min", str(args.min_din), "--max", str(args.max_din),
+           "--windows", str(args.windows), "--repeat", str(args.repeat)]
+    out = subprocess.run(cmd, check=True, stdout=subprocess.PIPE, text=True).stdout
+    return json.loads(out)["kernels"]
+
+
+def run_end_to_end(binary, args, workdir):
+    results = []
+    for size in args.sizes:
+        fasta = os.path.join(workdir, "synthetic_%d.fa" % size)
+        synthetic_fasta(fasta, size, args.seed)
+        for threads in args.threads:
+            # no --tune cache, so the timings don't depend on what was tuned here
+            env = dict(os.environ, OMP_NUM_THREADS=str(threads), ZHUNT_TUNE="")
+            best = None
+            for _ in range(args.e2e_repeat):
+                t0 = time.perf_counter()
+                subprocess.run([binary, str(args.window), str(args.min_din), str(args.max_din), fasta],
+                               check=True, stdout=subprocess.DEVNULL, env=env)
+                elapsed = time.perf_counter() - t0
+                best = elapsed if best is None else min(best, elapsed)
+            results.append({"size": size, "threads": threads, "seconds": best,
+                            "bases_per_second": size / best})
+            print("end-to-end %d bases, %d threads: %.3f s" % (size, threads, best), file=sys.stderr)
+        os.remove(fasta)
+        os.remove(fasta + ".Z-SCORE")
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--zhunt", default="./zhunt", help="zhunt binary")
+    parser.add_argument("--kernels", default="./bench_kernels", help="bench_kernels binary")
+    parser.add_argument("-o", "--output", default="-", help="JSON output file")
+    parser.add_argument("--min-din", type=int, default=6)
+    parser.add_argument("--max-din", type=int, default=24)
+    parser.add_argument("--window", type=int, default=24, help="windowsize passed to zhunt")
+    parser.add_argument("--windows", type=int, default=2048, help="windows per kernel timing")
+    parser.add_argument("--repeat", type=int, default=5, help="kernel timings per measurement")
+    parser.add_argument("--sizes", type=parse_list, default=[10000, 100000, 1000000, 10000000, 100000000],
+                        help="comma separated end-to-end sequence sizes")
+    parser.add_argument("--threads", type=parse_list, default=None,
+                        help="comma separated thread counts (default: powers of two up to the core count)")
+    parser.add_argument("--e2e-repeat", type=int, default=1, help="end-to-end runs per measurement")
+    parser.add_argument("--skip-kernels", action="store_true")
+    parser.add_argument("--skip-end-to-end", action="store_true")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    if args.threads is None:
+        cores = os.cpu_count() or 1
+        args.threads = [1]
+        while args.threads[-1] * 2 <= cores:
+            args.threads.append(args.threads[-1] * 2)
+        if args.threads[-1] != cores:
+            args.threads.append(cores)
+
+    report = {
+        "host": {"cpu": cpu_model(), "cores": os.cpu_count(), "machine": platform.machine()},
+        "timestamp": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "kernels": [],
+        "end_to_end": [],
+    }
+    if not args.skip_kernels:
+        report["kernels"] = run_kernels(args.kernels, args)
+    if not args.skip_end_to_end:
+        with tempfile.TemporaryDirectory(prefix="zhunt-bench-") as workdir:
+            report["end_to_end"] = run_end_to_end(args.zhunt, args, workdir)
+
+    text = json.dumps(report, indent=2)
+    if args.output == "-":
+        print(text)
+    else:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+
+
+if __name__ == "__main__":
+    main()
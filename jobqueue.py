@@ -0,0 +1,293 @@
+"""Filesystem job queue and worker pool for the web front end.
+
+Each job is a JSON file that moves between the state directories of the
+queue (queued -> running -> done/failed); a worker claims a job by renaming
+it into running/, which is atomic, so any number of pools can share a queue.
+The next job goes to the user with the fewest jobs running and, among those,
+the one served longest ago (served.json), so one user's batch of uploads
+doesn't hold everyone else up; a user's own jobs run oldest first. Each job runs
+zhunt with OMP_NUM_THREADS set to its share of the CPUs.
+
+A job gets at most ZHUNT_DEADLINE seconds, after which zhunt stops by itself,
+keeping what it has scored; cancelling a running job leaves a marker in
+cancel/ that its worker, whichever process it is in, turns into a SIGTERM to
+the same effect. Either way the job is done, marked partial.
+
+A running job records the host and process of its worker and the pid of its
+zhunt. When a pool starts, the running jobs of this host whose worker process
+is gone (it died, or the web server restarted) are stopped if their zhunt is
+still at it, and queued again; one that has been through this MAX_RESTARTS
+times fails instead.
+
+Settings (environment):
+    ZHUNT_WORKERS       jobs run at once (default 1)
+    ZHUNT_THREADS       OpenMP threads per job (default CPUs / workers)
+    ZHUNT_QUEUE_LIMIT   jobs waiting before uploads are refused (default 32)
+    ZHUNT_USER_LIMIT    jobs waiting per user (default 4)
+    ZHUNT_DEADLINE      seconds a job may run, 0 for no limit (default 0)
+
+Run `python jobqueue.py` to serve a queue from a separate process.
+"""
+import json
+import os
+import signal
+import socket
+import subprocess
+import tempfile
+import threading
+import time
+import uuid
+
+STATES = ['queued', 'running', 'done', 'failed']
+PARTIAL = 2  # exit status of a zhunt run stopped early
+POLL_INTERVAL = 1.0  # seconds between looks at an empty queue
+MAX_RESTARTS = 2  # times a job is queued again after its worker went away
+UNCLAIMED_GRACE = 60  # seconds a running job may go without its worker's mark
+
+
+def setting(name, default):
+    return int(os.environ.get(name, default))
+
+
+def alive(pid):
+    try:
+        os.kill(pid, 0)
+    except ProcessLookupError:
+        return False
+    except PermissionError:
+        pass  # someone else's
+    return True
+
+
+def started(pid):
+    """When process `pid` started, in clock ticks since boot, None where /proc can't tell."""
+    try:
+        with open('/proc/%d/stat' % pid) as f:
+            return int(f.read().rsplit(')', 1)[1].split()[19])
+    except (OSError, IndexError, ValueError):
+        return None
+
+
+def runs_job(pid, job):
+    """Whether process `pid` is still the job's zhunt, not a process that took over its pid."""
+    try:
+        with open('/proc/%d/cmdline' % pid, 'rb') as f:
+            args = f.read().split(b'\0')
+    except OSError:
+        return False
+    return b'zhunt' in os.path.basename(args[0]) and os.fsencode(job['upload']) in args
+
+
+class QueueFull(Exception):
+    pass
+
+
+class JobQueue:
+    def __init__(self, root):
+        self.root = root
+        for state in STATES + ['cancel']:
+            os.makedirs(os.path.join(root, state), exist_ok=True)
+
+    def path(self, state, job_id):
+        return os.path.join(self.root, state, job_id + '.json')
+
+    def jobs(self, state):
+        jobs = []
+        for name in os.listdir(os.path.join(self.root, state)):
+            try:
+                with open(os.path.join(self.root, state, name)) as f:
+                    jobs.append(json.load(f))
+            except (OSError, ValueError):
+                pass  # moved on by a worker meanwhile
+        return jobs
+
+    def write(self, state, job):
+        temporary = self.path(state, job['id']) + '.tmp'
+        with open(temporary, 'w') as f:
+            json.dump(job, f)
+        os.rename(temporary, self.path(state, job['id']))
+
+    def submit(self, user, upload, args):
+        """Queues zhunt `args` on `upload`, raising QueueFull if there is no room."""
+        queued = self.jobs('queued')
+        if len(queued) >= setting('ZHUNT_QUEUE_LIMIT', 32):
+            raise QueueFull('The queue is full, please try again later.')
+        if sum(job['user'] == user for job in queued) >= setting('ZHUNT_USER_LIMIT', 4):
+            raise QueueFull('You already have jobs waiting, please wait for them to finish.')
+        job = {'id': uuid.uuid4().hex, 'user': user, 'upload': upload, 'args': args,
+               'submitted': time.time(), 'state': 'queued'}
+        self.write('queued', job)
+        return job['id']
+
+    def status(self, job_id):
+        if not job_id.isalnum():
+            return None
+        for state in STATES:
+            try:
+                with open(self.path(state, job_id)) as f:
+                    job = json.load(f)
+            except (OSError, ValueError):
+                continue
+            if state == 'queued':
+                job['position'] = sum(other['submitted'] <= job['submitted'] for other in self.jobs('queued'))
+            return job
+        return None
+
+    def cancel(self, job_id):
+        """Drops a queued job, or asks a running one to stop; returns its status."""
+        job = self.status(job_id)
+        if job is None or job['state'] not in ('queued', 'running'):
+            return job
+        if job['state'] == 'queued':
+            try:
+                os.rename(self.path('queued', job_id), self.path('failed', job_id))
+            except OSError:
+                return self.cancel(job_id)  # claimed meanwhile
+            job['state'] = 'failed'
+            job['error'] = 'Cancelled before it started.'
+            self.write('failed', job)
+            return job
+        open(os.path.join(self.root, 'cancel', job_id), 'w').close()
+        return job
+
+    def served(self):
+        try:
+            with open(os.path.join(self.root, 'served.json')) as f:
+                return json.load(f)
+        except (OSError, ValueError):
+            return {}
+
+    def claim(self):
+        """Moves the next job, by fair share, to running/ and returns it."""
+        running = {}
+        for job in self.jobs('running'):
+            running[job['user']] = running.get(job['user'], 0) + 1
+        served = self.served()
+        order = lambda job: (running.get(job['user'], 0), served.get(job['user'], 0), job['submitted'])
+        for job in sorted(self.jobs('queued'), key=order):
+            try:
+                os.rename(self.path('queued', job['id']), self.path('running', job['id']))
+            except OSError:
+                continue  # another worker took it
+            job['state'] = 'running'
+            job['host'] = socket.gethostname()
+            job['worker'] = os.getpid()
+            job['worker_started'] = started(os.getpid())  # a restarted server may get the same pid
+            self.write('running', job)
+            served[job['user']] = time.time()
+            temporary = os.path.join(self.root, 'served.json.%d.%d' % (os.getpid(), threading.get_ident()))
+            with open(temporary, 'w') as f:
+                json.dump(served, f)
+            os.rename(temporary, os.path.join(self.root, 'served.json'))
+            return job
+        return None
+
+    def run(self, job, threads):
+        job['state'] = 'running'
+        job['started'] = time.time()
+        job['threads'] = threads
+        self.write('running', job)
+        env = dict(os.environ, OMP_NUM_THREADS=str(threads))
+        args = job['args']
+        deadline = setting('ZHUNT_DEADLINE', 0)
+        if deadline > 0:
+            args = ['--deadline', str(deadline)] + args
+        cancel = os.path.join(self.root, 'cancel', job['id'])
+        try:
+            # stderr goes to a file, a long job reports progress into it for hours
+            with tempfile.TemporaryFile('w+') as stderr:
+                process = subprocess.Popen(['zhunt'] + args + [job['upload']], env=env,
+                                           stdout=subprocess.DEVNULL, stderr=stderr)
+                job['process'] = process.pid
+                self.write('running', job)
+                signalled = False
+                while True:
+                    try:
+                        process.wait(POLL_INTERVAL)
+                        break
+                    except subprocess.TimeoutExpired:
+                        # only once, a second SIGTERM kills zhunt outright
+                        if not signalled and os.path.exists(cancel):
+                            process.send_signal(signal.SIGTERM)
+                            signalled = True
+                stderr.seek(0)
+                job['returncode'] = process.returncode
+                job['error'] = stderr.read()[-2000:]
+        except OSError as error:
+            job['returncode'] = -1
+            job['error'] = str(error)
+        job['finished'] = time.time()
+        job['partial'] = job['returncode'] == PARTIAL
+        job['state'] = 'done' if job['returncode'] in (0, PARTIAL) else 'failed'
+        self.write(job['state'], job)
+        os.remove(self.path('running', job['id']))
+        if os.path.exists(cancel):
+            os.remove(cancel)
+
+    def recover(self):
+        """Queues again, or fails, the running jobs of this host whose worker is gone."""
+        host = socket.gethostname()
+        for job in self.jobs('running'):
+            if 'worker' not in job:
+                # between the claim and the worker's mark, or from before workers marked their jobs
+                try:
+                    if time.time() - os.path.getmtime(self.path('running', job['id'])) < UNCLAIMED_GRACE:
+                        continue
+                except OSError:
+                    continue  # finished meanwhile
+            elif job['host'] != host or (alive(job['worker']) and started(job['worker']) == job.get('worker_started')):
+                continue
+            # taken over by one pool only, should several start at once
+            taken = os.path.join(self.root, job['id'] + '.recover')
+            try:
+                os.rename(self.path('running', job['id']), taken)
+            except OSError:
+                continue
+            if 'process' in job and alive(job['process']) and runs_job(job['process'], job):
+                try:
+                    os.kill(job['process'], signal.SIGKILL)  # or two runs would write the same results
+                except OSError:
+                    pass
+            restarts = job.get('restarts', 0) + 1
+            for key in ('host', 'worker', 'worker_started', 'process', 'started', 'threads'):
+                job.pop(key, None)
+            job['restarts'] = restarts
+            cancel = os.path.join(self.root, 'cancel', job['id'])
+            if os.path.exists(cancel):
+                os.remove(cancel)
+                job['state'] = 'failed'
+                job['error'] = 'Cancelled after its worker stopped.'
+            elif restarts > MAX_RESTARTS:
+                job['state'] = 'failed'
+                job['error'] = 'The worker running it stopped %d times.' % restarts
+            else:
+                job['state'] = 'queued'
+            if job['state'] == 'failed':
+                job['finished'] = time.time()
+            self.write(job['state'], job)
+            os.remove(taken)
+
+    def work(self, threads):
+        while True:
+            job = self.claim()
+            if job is None:
+                time.sleep(POLL_INTERVAL)
+            else:
+                self.run(job, threads)
+
+    def start_workers(self, workers=None, threads=None):
+        """Starts the pool in the background; zhunt does the work, so threads do."""
+        workers = setting('ZHUNT_WORKERS', 1) if workers is None else workers
+        if threads is None:
+            threads = setting('ZHUNT_THREADS', max(1, (os.cpu_count() or 1) // max(1, workers)))
+        if workers > 0:
+            self.recover()
+        for _ in range(workers):
+            threading.Thread(target=self.work, args=(threads,), daemon=True).start()
+        return workers
+
+
+if __name__ == '__main__':
+    queue = JobQueue(os.path.join(os.getcwd(), 'uploads', 'queue'))
+    if queue.start_workers() > 0:
+        threading.Event().wait()
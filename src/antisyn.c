@@ -1,3 +1,6 @@
+#include "antisyn.h"
+#include "specialize.h"
+
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -30,6 +33,8 @@ static const int int_dbzed[4][16] = {
 };
 static double expdbzed[4][16]; /* exp(-dbzed/rt) */
 
+static void antisyn_specialize(void);
+
 void antisyn_init()
 {
     static double rt = 0.59004; /* 0.00198*298 */
@@ -38,11 +43,12 @@ void antisyn_init()
             expdbzed[i][j] = exp(-dbzed[i][j] / rt);
         }
     }
+    antisyn_specialize();
 }
 
 void antisyn_destroy(void) {}
 
-void assign_bzenergy_index(int nucleotides, const char* seq, int* bzindex)
+void assign_bzenergy_index(int nucleotides, const char* seq, bzindex_t* bzindex)
 {
     int i = 0;
     int j = 0;
@@ -115,7 +121,7 @@ void assign_bzenergy_index(int nucleotides, const char* seq, int* bzindex)
     } while (i < nucleotides);
 }
 
-static void antisyn_01_bzenergy(int dinucleotides, const char* antisyn, const int* bzindex, double* bzenergy)
+static void antisyn_01_bzenergy(int dinucleotides, const char* antisyn, const bzindex_t* bzindex, double* bzenergy)
 {
     if (dinucleotides == 0) {
         return;
@@ -136,7 +142,7 @@ static void antisyn_01_bzenergy(int dinucleotides, const char* antisyn, const in
     }
 }
 
-void antisyn_bzenergy(int dinucleotides, const char* antisyn_string, const int* bzindex, double* bzenergy)
+void antisyn_bzenergy(int dinucleotides, const char* antisyn_string, const bzindex_t* bzindex, double* bzenergy)
 {
     if (dinucleotides == 0) {
         return;
@@ -174,7 +180,8 @@ static void antisyn_string(const char* antisyn, int dinucleotides, char* dest)
     dest[2 * dinucleotides] = '\0';
 }
 
-void find_best_antisyn(int dinucleotides, const int* bzindex, char* antisyn_out)
+/* inlined into a kernel per specialized size, see specialize.h */
+static ALWAYS_INLINE void best_antisyn(int dinucleotides, const bzindex_t* bzindex, char* antisyn_out)
 {
     if (dinucleotides < 1) {
         return;
@@ -189,6 +196,7 @@ void find_best_antisyn(int dinucleotides, const int* bzindex, char* antisyn_out)
     char best1_antisyn[dinucleotides];
     best1_antisyn[0] = 1;
 
+    #pragma GCC unroll 32
     for (int din = 1; din < dinucleotides; ++din) {
         const esum_t dbzed00 = int_dbzed[0][bzindex[din]];
         const esum_t dbzed01 = int_dbzed[1][bzindex[din]];
@@ -225,3 +233,182 @@ void find_best_antisyn(int dinucleotides, const int* bzindex, char* antisyn_out)
     char* best_antisyn = best0_esum <= best1_esum ? best0_antisyn : best1_antisyn;
     antisyn_string(best_antisyn, dinucleotides, antisyn_out);
 }
+
+/* The DP of best_antisyn for up to ANTISYN_LANES windows at once, one per lane.
+   A conformation is kept as bits, the first dinucleotide highest and 1 for SA,
+   so that comparing two as integers compares them in the order of strncmp.
+   strncmp also stops at the first dinucleotide that is AS (0) in both, so x
+   is before y when the highest bit set in (x ^ y) | common AS bits is one of
+   y & ~x, that is when y & ~x > (x & ~y) | common AS bits. The DP for the first d dinucleotides is the
+   start of the DP for more, so a single pass leaves the best conformation of
+   every window size d <= dinucleotides in paths[d - 1]. */
+typedef struct {
+    int32_t esum[2][ANTISYN_LANES]; /* best energy so far ending AS (0) and SA (1) */
+    uint32_t antisyn[2][ANTISYN_LANES];
+} LaneState;
+
+/* unused lanes repeat the first window */
+static ALWAYS_INLINE void lanes_first(const bzindex_t* const* bzindex, int n, LaneState* state, uint32_t* paths)
+{
+    for (int lane = 0; lane < ANTISYN_LANES; lane++) {
+        int idx = bzindex[(lane < n) ? lane : 0][0];
+        state->esum[0][lane] = int_dbzed[0][idx];
+        state->esum[1][lane] = int_dbzed[3][idx];
+        state->antisyn[0][lane] = 0;
+        state->antisyn[1][lane] = 1;
+        paths[lane] = (state->esum[0][lane] <= state->esum[1][lane]) ? 0 : 1;
+    }
+}
+
+static ALWAYS_INLINE void lanes_step(int din, const bzindex_t* const* bzindex, int n, LaneState* state, uint32_t* paths)
+{
+    const uint32_t mask = (2u << (din - 1)) - 1; /* din dinucleotides so far */
+    int32_t dbzed[4][ANTISYN_LANES];
+    for (int lane = 0; lane < ANTISYN_LANES; lane++) {
+        int idx = bzindex[(lane < n) ? lane : 0][din];
+        for (int i = 0; i < 4; i++) {
+            dbzed[i][lane] = int_dbzed[i][idx];
+        }
+    }
+
+    #pragma omp simd
+    for (int lane = 0; lane < ANTISYN_LANES; lane++) {
+        const int32_t prev_best0 = state->esum[0][lane];
+        const int32_t prev_best1 = state->esum[1][lane];
+        const uint32_t antisyn0 = state->antisyn[0][lane];
+        const uint32_t antisyn1 = state->antisyn[1][lane];
+
+        /* strncmp(best0, best1) <= 0 */
+        const uint32_t both_as = ~(antisyn0 | antisyn1) & mask;
+        const int before0 = !((antisyn0 & ~antisyn1) > ((antisyn1 & ~antisyn0) | both_as));
+        const int32_t esum00 = prev_best0 + dbzed[0][lane];
+        const int32_t esum10 = prev_best1 + dbzed[2][lane];
+        const int keep0 = (esum00 < esum10) | ((esum00 == esum10) & before0);
+        const int32_t esum0 = keep0 ? esum00 : esum10;
+        const uint32_t next0 = keep0 ? antisyn0 : antisyn1;
+
+        /* strncmp(best1, best0) < 0, against best0 as just updated */
+        const uint32_t both_as1 = ~(antisyn1 | next0) & mask;
+        const int before1 = (next0 & ~antisyn1) > ((antisyn1 & ~next0) | both_as1);
+        const int32_t esum01 = prev_best0 + dbzed[1][lane];
+        const int32_t esum11 = prev_best1 + dbzed[3][lane];
+        const int keep1 = (esum11 < esum01) | ((esum11 == esum01) & before1);
+        const int32_t esum1 = keep1 ? esum11 : esum01;
+        const uint32_t next1 = keep1 ? antisyn1 : antisyn0;
+
+        state->esum[0][lane] = esum0;
+        state->esum[1][lane] = esum1;
+        state->antisyn[0][lane] = next0 << 1;
+        state->antisyn[1][lane] = (next1 << 1) | 1;
+        paths[lane] = (esum0 <= esum1) ? state->antisyn[0][lane] : state->antisyn[1][lane];
+    }
+}
+
+void find_best_antisyn_lanes(int dinucleotides, const bzindex_t* const* bzindex, int n, uint32_t (*paths)[ANTISYN_LANES])
+{
+    LaneState state;
+    lanes_first(bzindex, n, &state, paths[0]);
+    for (int din = 1; din < dinucleotides; ++din) {
+        lanes_step(din, bzindex, n, &state, paths[din]);
+    }
+}
+
+/* The best conformations of n variants of the window at bzindex, variant v
+   with dinucleotide din[v] made idx[v], din[] ascending. Up to its changed
+   dinucleotide a variant's DP is the window's own, which is run once: each
+   batch of ANTISYN_LANES variants carries on from where its first one departs.
+   paths[v * dinucleotides + d] is the conformation of window size d + 1 for
+   d >= din[v], the sizes that hold the change. */
+void find_best_antisyn_substituted(int dinucleotides, const bzindex_t* bzindex, int n, const int* din, const bzindex_t* idx, uint32_t* paths)
+{
+    LaneState states[dinucleotides]; /* the window's own, in every lane */
+    uint32_t lanepaths[dinucleotides][ANTISYN_LANES];
+    const bzindex_t* window[ANTISYN_LANES] = { bzindex };
+    lanes_first(window, 1, &states[0], lanepaths[0]);
+    for (int d = 1; d < dinucleotides; d++) {
+        states[d] = states[d - 1];
+        lanes_step(d, window, 1, &states[d], lanepaths[d]);
+    }
+
+    bzindex_t variants[ANTISYN_LANES][dinucleotides];
+    for (int first = 0; first < n; first += ANTISYN_LANES) {
+        int count = (n - first < ANTISYN_LANES) ? n - first : ANTISYN_LANES;
+        for (int lane = 0; lane < count; lane++) {
+            memcpy(variants[lane], bzindex, dinucleotides);
+            variants[lane][din[first + lane]] = idx[first + lane];
+            window[lane] = variants[lane];
+        }
+        int start = din[first];
+        LaneState state;
+        if (start == 0) {
+            lanes_first(window, count, &state, lanepaths[0]);
+        } else {
+            state = states[start - 1];
+        }
+        for (int d = (start > 0) ? start : 1; d < dinucleotides; d++) {
+            lanes_step(d, window, count, &state, lanepaths[d]);
+        }
+        for (int lane = 0; lane < count; lane++) {
+            for (int d = din[first + lane]; d < dinucleotides; d++) {
+                paths[(first + lane) * dinucleotides + d] = lanepaths[d][lane];
+            }
+        }
+    }
+}
+
+/* antisyn_bzenergy for a conformation from find_best_antisyn_lanes */
+void antisyn_path_bzenergy(int dinucleotides, uint32_t path, const bzindex_t* bzindex, double* bzenergy)
+{
+    int previous = (path >> (dinucleotides - 1)) & 1;
+    bzenergy[0] = expdbzed[previous ? 3 : 0][bzindex[0]];
+    for (int din = 1; din < dinucleotides; ++din) {
+        int sa = (path >> (dinucleotides - 1 - din)) & 1;
+        bzenergy[din] = expdbzed[2 * previous + sa][bzindex[din]];
+        previous = sa;
+    }
+}
+
+/* the antisyn string of a conformation from find_best_antisyn_lanes */
+void antisyn_path_string(int dinucleotides, uint32_t path, char* antisyn_out)
+{
+    for (int din = 0; din < dinucleotides; ++din) {
+        int sa = (path >> (dinucleotides - 1 - din)) & 1;
+        antisyn_out[2 * din] = sa ? 'S' : 'A';
+        antisyn_out[2 * din + 1] = sa ? 'A' : 'S';
+    }
+    antisyn_out[2 * dinucleotides] = '\0';
+}
+
+typedef void best_antisyn_kernel(const bzindex_t* bzindex, char* antisyn_out);
+
+#define BEST_ANTISYN_KERNEL(n)                                               \
+    static void best_antisyn_##n(const bzindex_t* bzindex, char* antisyn_out) \
+    {                                                                         \
+        best_antisyn(n, bzindex, antisyn_out);                                \
+    }
+SPECIALIZE_SIZES(BEST_ANTISYN_KERNEL)
+
+static best_antisyn_kernel* best_antisyn_kernels[SPECIALIZE_LIMIT + 1];
+static int kernels = 1; /* the specialized ones */
+
+static void antisyn_specialize(void)
+{
+#define BEST_ANTISYN_ENTRY(n) best_antisyn_kernels[n] = best_antisyn_##n;
+    SPECIALIZE_SIZES(BEST_ANTISYN_ENTRY)
+}
+
+/* whether find_best_antisyn takes the specialized kernels (the default) or
+   the generic one; the results are the same */
+void antisyn_specialized(int enabled)
+{
+    kernels = enabled;
+}
+
+void find_best_antisyn(int dinucleotides, const bzindex_t* bzindex, char* antisyn_out)
+{
+    if (kernels && dinucleotides >= 1 && dinucleotides <= SPECIALIZE_LIMIT && best_antisyn_kernels[dinucleotides] != NULL) {
+        best_antisyn_kernels[dinucleotides](bzindex, antisyn_out);
+    } else {
+        best_antisyn(dinucleotides, bzindex, antisyn_out);
+    }
+}
@@ -1,8 +1,20 @@
 #pragma once
 
+#include <stdint.h>
+
+typedef unsigned char bzindex_t;
+
 void antisyn_init(void);
 void antisyn_destroy(void);
+void antisyn_specialized(int enabled);
+
+void assign_bzenergy_index(int nucleotides, const char* seq, bzindex_t* bzindex);
+void find_best_antisyn(int dinucleotides, const bzindex_t* bzindex, char* antisyn_out);
+void antisyn_bzenergy(int dinucleotides, const char* antisyn, const bzindex_t* bzindex, double* bzenergy);
+#define ANTISYN_LANES 16 /* windows in one lane-parallel pass */
+#define ANTISYN_LANE_DIN 32 /* longest conformation the lanes hold */
 
-void assign_bzenergy_index(int nucleotides, const char* seq, int* bzindex);
-void find_best_antisyn(int dinucleotides, const int* bzindex, char* antisyn_out);
-void antisyn_bzenergy(int dinucleotides, const char* antisyn, const int* bzindex, double* bzenergy);
\ No newline at end of file
+void find_best_antisyn_lanes(int dinucleotides, const bzindex_t* const* bzindex, int n, uint32_t (*paths)[ANTISYN_LANES]);
+void find_best_antisyn_substituted(int dinucleotides, const bzindex_t* bzindex, int n, const int* din, const bzindex_t* idx, uint32_t* paths);
+void antisyn_path_string(int dinucleotides, uint32_t path, char* antisyn_out);
+void antisyn_path_bzenergy(int dinucleotides, uint32_t path, const bzindex_t* bzindex, double* bzenergy);
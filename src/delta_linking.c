@@ -1,4 +1,6 @@
 #include "delta_linking.h"
+#include "instrument.h"
+#include "specialize.h"
 
 #include <math.h>
 #include <stdlib.h>
@@ -7,6 +9,12 @@ static double *bztwist; // Read-only after init
 static const double _k_rt = -0.2521201; /* -1100/4363 */
 static const double sigma = 16.94800353; /* 10/RT */
 static const double explimit = -600.0;
+static const double shift_cancellation = 0.125; /* least fraction of a sum an update may keep */
+static double twist0, twiststep; /* bztwist[i] = twist0 + twiststep * i */
+static int method = DELTA_LINKING_FACTORED;
+static int kernels = 1; /* the specialized ones */
+
+static void delta_linking_specialize(void);
 
 void delta_linking_init(int max_dinucleotides)
 {
@@ -14,11 +22,14 @@ void delta_linking_init(int max_dinucleotides)
     double ab;
 
     bztwist = (double*)calloc(max_dinucleotides, sizeof(double));
+    twist0 = b + b + a;
+    twiststep = a;
     ab = b + b;
     for (int i = 0; i < max_dinucleotides; i++) {
         ab += a;
         bztwist[i] = ab;
     }
+    delta_linking_specialize();
 }
 
 void delta_linking_destroy(void)
@@ -26,7 +37,23 @@ void delta_linking_destroy(void)
     free(bztwist);
 }
 
-static void delta_linking_exponent(double dl, int terms, const double* logcoef, double* expmini_out, double* exponent) {
+/* DELTA_LINKING_FACTORED (the default) or DELTA_LINKING_DIRECT */
+void delta_linking_method(int m)
+{
+    method = m;
+}
+
+/* whether the sizes compiled separately (specialize.h) take their own kernels
+   (the default) or the generic ones; the results are the same */
+void delta_linking_specialized(int enabled)
+{
+    kernels = enabled;
+}
+
+/* The functions below are inlined into a kernel per specialized size, see specialize.h */
+
+static ALWAYS_INLINE void delta_linking_exponent(double dl, int terms, const double* logcoef, double* expmini_out, double* exponent)
+{
     double expmini = 0.0;
     #pragma omp simd reduction(min:expmini)
     for (int i = 0; i < terms; i++) {
@@ -39,7 +66,7 @@ static void delta_linking_exponent(double dl, int terms, const double* logcoef,
     *expmini_out = (expmini < explimit) ? explimit - expmini : 0.0;
 }
 
-static double delta_linking(double dl, double deltatwist, const double* logcoef, int terms)
+static ALWAYS_INLINE double delta_linking(double dl, double deltatwist, const double* logcoef, int terms)
 {
     double expmini;
     double exponent[terms];
@@ -54,13 +81,76 @@ static double delta_linking(double dl, double deltatwist, const double* logcoef,
         sump += bztwist[i] * z;
     }
     sumq += exp(_k_rt * dl * dl + sigma + expmini);
+    INSTRUMENT_COUNT(COUNTER_DELTA_LINKING, 1);
+    INSTRUMENT_COUNT(COUNTER_EXP, terms + 1);
     return deltatwist - sump / sumq;
 }
 
-static double linear_search_dl(double x1, double x2, double tole, double deltatwist, const double* logcoef, int terms)
+/* Since bztwist[i] = twist0 + twiststep * i, with u = dl - twist0 the exponent
+   of term i, logcoef[i] + k (u - twiststep i)^2, is the dl-free
+   c[i] = logcoef[i] + k twiststep^2 i^2 plus k u^2 - i ln(r), with
+   r = exp(2 k twiststep u) <= 1 for dl in the search range. Relative to a
+   common factor the sums become polynomials in r with coefficients
+   exp(c[i] - max c), evaluated by Horner's rule: two exp calls per point. */
+static ALWAYS_INLINE void factor_coefficients(int terms, const double* logcoef, double* coef, double* scale)
 {
-    double f = delta_linking(x1, deltatwist, logcoef, terms);
-    double fmid = delta_linking(x2, deltatwist, logcoef, terms);
+    double cmax = -INFINITY;
+    for (int i = 0; i < terms; i++) {
+        coef[i] = logcoef[i] + _k_rt * twiststep * twiststep * i * i;
+        cmax = (coef[i] > cmax) ? coef[i] : cmax;
+    }
+    for (int i = 0; i < terms; i++) {
+        coef[i] = exp(coef[i] - cmax);
+    }
+    *scale = cmax;
+    INSTRUMENT_COUNT(COUNTER_EXP, terms);
+}
+
+/* sums of coef[i] r^(terms-1-i) times 1, i and i^2; returns the free term
+   exp(k dl^2 + sigma) relative to the common factor of the others */
+static ALWAYS_INLINE double factored_sums(double dl, const double* coef, double scale, int terms, double* p0, double* p1, double* p2)
+{
+    double u = dl - twist0;
+    double logr = 2.0 * _k_rt * twiststep * u;
+    double r = exp(logr);
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0;
+    for (int i = 0; i < terms; i++) {
+        s0 = s0 * r + coef[i];
+        s1 = s1 * r + i * coef[i];
+        if (p2 != NULL) {
+            s2 = s2 * r + i * i * coef[i];
+        }
+    }
+    *p0 = s0;
+    *p1 = s1;
+    if (p2 != NULL) {
+        *p2 = s2;
+    }
+    INSTRUMENT_COUNT(COUNTER_EXP, 2);
+    return exp(_k_rt * (dl * dl - u * u) + sigma - scale + (terms - 1) * logr);
+}
+
+static ALWAYS_INLINE double factored_delta_linking(double dl, double deltatwist, const double* coef, double scale, int terms)
+{
+    double p0, p1;
+    double free = factored_sums(dl, coef, scale, terms, &p0, &p1, NULL);
+    INSTRUMENT_COUNT(COUNTER_DELTA_LINKING, 1);
+    return deltatwist - (twist0 * p0 + twiststep * p1) / (p0 + free);
+}
+
+/* 'values' are the logcoef, or the factored coefficients with their scale */
+static ALWAYS_INLINE double evaluate(int factored, double dl, double deltatwist, const double* values, double scale, int terms)
+{
+    if (factored) {
+        return factored_delta_linking(dl, deltatwist, values, scale, terms);
+    }
+    return delta_linking(dl, deltatwist, values, terms);
+}
+
+static ALWAYS_INLINE double linear_search_dl(double x1, double x2, double tole, double deltatwist, const double* values, double scale, int terms, int factored)
+{
+    double f = evaluate(factored, x1, deltatwist, values, scale, terms);
+    double fmid = evaluate(factored, x2, deltatwist, values, scale, terms);
     if (f * fmid >= 0.0) {
         return x2;
     }
@@ -70,15 +160,18 @@ static double linear_search_dl(double x1, double x2, double tole, double deltatw
     do {
         dx *= 0.5;
         xmid = x + dx;
-        fmid = delta_linking(xmid, deltatwist, logcoef, terms);
+        fmid = evaluate(factored, xmid, deltatwist, values, scale, terms);
         if (fmid <= 0.0) {
             x = xmid;
         }
+        INSTRUMENT_COUNT(COUNTER_BISECTION, 1);
     } while (fabs(dx) > tole);
     return x;
 }
 
-void delta_linking_logcoef(int dinucleotides, const double* best_bzenergy, double* logcoef)
+/* logcoef[i] is the log of the sum of the products of every i + 1 consecutive
+   energies; the sums themselves are kept in sums[i] unless it is NULL */
+static ALWAYS_INLINE void logcoef_kernel(int dinucleotides, const double* best_bzenergy, double* logcoef, double* sums)
 {
     double bzenergy_scratch[dinucleotides];
 
@@ -92,18 +185,53 @@ void delta_linking_logcoef(int dinucleotides, const double* best_bzenergy, doubl
             sum += bzenergy_scratch[j];
         }
         logcoef[i] = log(sum);
+        if (sums != NULL) {
+            sums[i] = sum;
+        }
     }
 }
 
-double find_delta_linking(int dinucleotides, double dtwist, const double* logcoef)
+/* roots for several deltatwist values, sharing the coefficients */
+static ALWAYS_INLINE void roots_kernel(const double* dtwist, int n, const double* logcoef, double* dl, int terms)
 {
-    return linear_search_dl(10.0, 50.0, 0.001, dtwist, logcoef, dinucleotides);
+    if (method == DELTA_LINKING_DIRECT) {
+        for (int k = 0; k < n; k++) {
+            dl[k] = linear_search_dl(10.0, 50.0, 0.001, dtwist[k], logcoef, 0.0, terms, 0);
+        }
+        return;
+    }
+    double coef[terms];
+    double scale;
+    factor_coefficients(terms, logcoef, coef, &scale);
+    for (int k = 0; k < n; k++) {
+        dl[k] = linear_search_dl(10.0, 50.0, 0.001, dtwist[k], coef, scale, terms, 1);
+    }
 }
 
-double delta_linking_slope(double dl, const double* logcoef, int terms)
+static ALWAYS_INLINE double factored_slope(double dl, const double* logcoef, int terms)
+{
+    double coef[terms];
+    double scale, p0, p1, p2;
+    factor_coefficients(terms, logcoef, coef, &scale);
+    double free = factored_sums(dl, coef, scale, terms, &p0, &p1, &p2);
+
+    double u = dl - twist0;
+    double x = 2.0 * _k_rt;
+    double sumq = p0 + free;
+    double sump = twist0 * p0 + twiststep * p1;
+    double sumq1 = x * (u * p0 - twiststep * p1 + dl * free);
+    double sump1 = x * (twist0 * u * p0 + twiststep * (u - twist0) * p1 - twiststep * twiststep * p2);
+    return (sump1 - sump * sumq1 / sumq) / sumq;
+}
+
+static ALWAYS_INLINE double slope_kernel(double dl, const double* logcoef, int terms)
 {
     double sump, sump1, sumq, sumq1, x, y, z;
 
+    if (method == DELTA_LINKING_FACTORED) {
+        return factored_slope(dl, logcoef, terms);
+    }
+
     double expmini;
     double exponent[terms];
     delta_linking_exponent(dl, terms, logcoef, &expmini, exponent);
@@ -122,5 +250,116 @@ double delta_linking_slope(double dl, const double* logcoef, int terms)
     y = exp(_k_rt * dl * dl + sigma + expmini);
     sumq += y;
     sumq1 += x * dl * y;
+    INSTRUMENT_COUNT(COUNTER_EXP, terms + 1);
     return (sump1 - sump * sumq1 / sumq) / sumq;
 } /* slope at delta linking = dl */
+
+typedef void logcoef_fn(const double* best_bzenergy, double* logcoef, double* sums);
+typedef void roots_fn(const double* dtwist, int n, const double* logcoef, double* dl);
+typedef double slope_fn(double dl, const double* logcoef);
+
+#define DELTA_LINKING_KERNELS(n)                                                          \
+    static void logcoef_##n(const double* best_bzenergy, double* logcoef, double* sums)   \
+    {                                                                                     \
+        logcoef_kernel(n, best_bzenergy, logcoef, sums);                                  \
+    }                                                                                     \
+    static void roots_##n(const double* dtwist, int k, const double* logcoef, double* dl) \
+    {                                                                                     \
+        roots_kernel(dtwist, k, logcoef, dl, n);                                          \
+    }                                                                                     \
+    static double slope_##n(double dl, const double* logcoef)                             \
+    {                                                                                     \
+        return slope_kernel(dl, logcoef, n);                                              \
+    }
+SPECIALIZE_SIZES(DELTA_LINKING_KERNELS)
+
+static logcoef_fn* logcoef_kernels[SPECIALIZE_LIMIT + 1];
+static roots_fn* roots_kernels[SPECIALIZE_LIMIT + 1];
+static slope_fn* slope_kernels[SPECIALIZE_LIMIT + 1];
+
+static void delta_linking_specialize(void)
+{
+#define DELTA_LINKING_ENTRIES(n)      \
+    logcoef_kernels[n] = logcoef_##n; \
+    roots_kernels[n] = roots_##n;     \
+    slope_kernels[n] = slope_##n;
+    SPECIALIZE_SIZES(DELTA_LINKING_ENTRIES)
+}
+
+static int specialized(int dinucleotides)
+{
+    return kernels && dinucleotides >= 1 && dinucleotides <= SPECIALIZE_LIMIT && roots_kernels[dinucleotides] != NULL;
+}
+
+void delta_linking_logcoef(int dinucleotides, const double* best_bzenergy, double* logcoef)
+{
+    delta_linking_logcoef_sums(dinucleotides, best_bzenergy, logcoef, NULL);
+}
+
+/* as delta_linking_logcoef, keeping the sums for delta_linking_logcoef_shift */
+void delta_linking_logcoef_sums(int dinucleotides, const double* best_bzenergy, double* logcoef, double* sums)
+{
+    if (specialized(dinucleotides)) {
+        logcoef_kernels[dinucleotides](best_bzenergy, logcoef, sums);
+    } else {
+        logcoef_kernel(dinucleotides, best_bzenergy, logcoef, sums);
+    }
+}
+
+/* The coefficients of a window one dinucleotide on from the one 'sums' holds
+   the sums of, whose conformation is the previous one's shifted left: the
+   energies are the same but for the first, which starts the window, and the
+   new last one, and 'dropped' are the previous window's first two. Each sum
+   loses the products that start at those two and gains the ones that start
+   at the new first dinucleotide or end at the new last one, in place and in
+   O(dinucleotides) rather than O(dinucleotides^2). Returns nonzero, leaving
+   the caller to recompute them, when the products dropped are most of a sum
+   and subtracting them would lose too much precision. */
+int delta_linking_logcoef_shift(int dinucleotides, const double* dropped, const double* best_bzenergy, double* logcoef, double* sums)
+{
+    double first = dropped[0], second = dropped[1], head = 1.0, tail = 1.0;
+    for (int i = 0; i < dinucleotides; i++) {
+        int last = dinucleotides - 1 - i; /* start of the last product of i + 1 energies */
+        if (i > 0) {
+            first *= (i == 1) ? dropped[1] : best_bzenergy[i - 1];
+            second *= best_bzenergy[i];
+        }
+        head *= best_bzenergy[i];
+        tail *= best_bzenergy[last];
+        double kept = 0.0; /* the products both windows share */
+        if (last > 1) {
+            kept = sums[i] - first - second;
+            if (kept < shift_cancellation * sums[i]) {
+                return 1;
+            }
+        }
+        sums[i] = (last > 0) ? kept + head + tail : head;
+        logcoef[i] = log(sums[i]);
+    }
+    return 0;
+}
+
+double find_delta_linking(int dinucleotides, double dtwist, const double* logcoef)
+{
+    double dl;
+    find_delta_linkings(dinucleotides, &dtwist, 1, logcoef, &dl);
+    return dl;
+}
+
+/* the roots for n values of deltatwist at once */
+void find_delta_linkings(int dinucleotides, const double* dtwist, int n, const double* logcoef, double* dl)
+{
+    if (specialized(dinucleotides)) {
+        roots_kernels[dinucleotides](dtwist, n, logcoef, dl);
+    } else {
+        roots_kernel(dtwist, n, logcoef, dl, dinucleotides);
+    }
+}
+
+double delta_linking_slope(double dl, const double* logcoef, int terms)
+{
+    if (specialized(terms)) {
+        return slope_kernels[terms](dl, logcoef);
+    }
+    return slope_kernel(dl, logcoef, terms);
+}
\ No newline at end of file
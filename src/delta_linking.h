@@ -1,7 +1,15 @@
 #pragma once
 
+enum { DELTA_LINKING_FACTORED,
+    DELTA_LINKING_DIRECT };
+
 void delta_linking_init(int max_dinucleotides);
 void delta_linking_destroy(void);
+void delta_linking_method(int method);
+void delta_linking_specialized(int enabled);
 void delta_linking_logcoef(int dinucleotides, const double* best_bzenergy, double* logcoef);
+void delta_linking_logcoef_sums(int dinucleotides, const double* best_bzenergy, double* logcoef, double* sums);
+int delta_linking_logcoef_shift(int dinucleotides, const double* dropped, const double* best_bzenergy, double* logcoef, double* sums);
 double delta_linking_slope(double dl, const double* logcoef, int terms);
-double find_delta_linking(int dinucleotides, double deltatwist, const double* logcoef);
\ No newline at end of file
+double find_delta_linking(int dinucleotides, double deltatwist, const double* logcoef);
+void find_delta_linkings(int dinucleotides, const double* deltatwist, int n, const double* logcoef, double* dl);
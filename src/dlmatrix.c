@@ -0,0 +1,130 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "dlmatrix.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static const char magic[8] = { 'Z', 'H', 'U', 'N', 'T', 'D', 'L', '1' };
+
+static size_t row_size(const DlMatrix* matrix)
+{
+    return (size_t)matrix->na * matrix->todin * sizeof(DinScore);
+}
+
+static int write_header(DlMatrix* matrix)
+{
+    int32_t sizes[3] = { matrix->windowsize, matrix->todin, matrix->na };
+    return (fwrite(magic, sizeof(magic), 1, matrix->file) == 1 && fwrite(sizes, sizeof(sizes), 1, matrix->file) == 1
+               && fwrite(matrix->a, sizeof(double), matrix->na, matrix->file) == (size_t)matrix->na)
+        ? 0
+        : -1;
+}
+
+/* a new matrix, or with 'offset' > 0 the one of an interrupted run cut back to 'offset' */
+DlMatrix* dlmatrix_create(const char* filename, int windowsize, int todin, int na, const double* a, long offset)
+{
+    DlMatrix* matrix = (DlMatrix*)calloc(1, sizeof(DlMatrix));
+    matrix->windowsize = windowsize;
+    matrix->todin = todin;
+    matrix->na = na;
+    memcpy(matrix->a, a, na * sizeof(double));
+
+    if (offset > 0) {
+        matrix->file = fopen(filename, "r+b");
+        if (matrix->file == NULL || ftruncate(fileno(matrix->file), offset) != 0 || fseek(matrix->file, 0, SEEK_END) != 0) {
+            dlmatrix_close(matrix);
+            return NULL;
+        }
+        return matrix;
+    }
+    matrix->file = fopen(filename, "wb");
+    if (matrix->file == NULL || write_header(matrix) != 0) {
+        dlmatrix_close(matrix);
+        return NULL;
+    }
+    return matrix;
+}
+
+DlMatrix* dlmatrix_open(const char* filename)
+{
+    DlMatrix* matrix = (DlMatrix*)calloc(1, sizeof(DlMatrix));
+    matrix->file = fopen(filename, "rb");
+    if (matrix->file == NULL) {
+        free(matrix);
+        return NULL;
+    }
+    char header[sizeof(magic)];
+    int32_t sizes[3];
+    if (fread(header, sizeof(header), 1, matrix->file) != 1 || memcmp(header, magic, sizeof(magic)) != 0
+        || fread(sizes, sizeof(sizes), 1, matrix->file) != 1 || sizes[1] < 1 || sizes[1] > MAX_MATRIX_DIN
+        || sizes[2] < 1 || sizes[2] > MAX_SWEEP) {
+        dlmatrix_close(matrix);
+        return NULL;
+    }
+    matrix->windowsize = sizes[0];
+    matrix->todin = sizes[1];
+    matrix->na = sizes[2];
+    if (fread(matrix->a, sizeof(double), matrix->na, matrix->file) != (size_t)matrix->na) {
+        dlmatrix_close(matrix);
+        return NULL;
+    }
+    return matrix;
+}
+
+void dlmatrix_close(DlMatrix* matrix)
+{
+    if (matrix->file != NULL) {
+        fclose(matrix->file);
+    }
+    free(matrix);
+}
+
+int dlmatrix_write_section(DlMatrix* matrix, const char* name, size_t length)
+{
+    uint32_t namelength = strlen(name);
+    uint64_t positions = length;
+    return (fwrite(&namelength, sizeof(namelength), 1, matrix->file) == 1
+               && fwrite(name, 1, namelength, matrix->file) == namelength
+               && fwrite(&positions, sizeof(positions), 1, matrix->file) == 1)
+        ? 0
+        : -1;
+}
+
+/* moves to the next section, giving its length; the name is only informative */
+int dlmatrix_read_section(DlMatrix* matrix, size_t* length)
+{
+    uint32_t namelength;
+    uint64_t positions;
+    if (fread(&namelength, sizeof(namelength), 1, matrix->file) != 1 || fseek(matrix->file, namelength, SEEK_CUR) != 0
+        || fread(&positions, sizeof(positions), 1, matrix->file) != 1) {
+        return -1;
+    }
+    *length = positions;
+    return 0;
+}
+
+int dlmatrix_write(DlMatrix* matrix, const DinScore* scores, size_t positions)
+{
+    return fwrite(scores, row_size(matrix), positions, matrix->file) == positions ? 0 : -1;
+}
+
+int dlmatrix_read(DlMatrix* matrix, DinScore* scores, size_t positions)
+{
+    return fread(scores, row_size(matrix), positions, matrix->file) == positions ? 0 : -1;
+}
+
+int dlmatrix_skip(DlMatrix* matrix, size_t positions)
+{
+    return fseeko(matrix->file, (off_t)(positions * row_size(matrix)), SEEK_CUR);
+}
+
+/* how far the matrix is complete, for checkpoints */
+long dlmatrix_tell(DlMatrix* matrix)
+{
+    fflush(matrix->file);
+    return ftell(matrix->file);
+}
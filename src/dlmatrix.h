@@ -0,0 +1,27 @@
+#pragma once
+
+#include "zscore.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* A dl matrix file: the header, then for each scored sequence a section
+   header and, per position, na rows of 'todin' DinScores (window sizes
+   1..todin), all in native byte order. */
+typedef struct {
+    FILE* file;
+    int windowsize;
+    int todin;
+    int na;
+    double a[MAX_SWEEP];
+} DlMatrix;
+
+DlMatrix* dlmatrix_create(const char* filename, int windowsize, int todin, int na, const double* a, long offset);
+DlMatrix* dlmatrix_open(const char* filename);
+void dlmatrix_close(DlMatrix* matrix);
+int dlmatrix_write_section(DlMatrix* matrix, const char* name, size_t length);
+int dlmatrix_read_section(DlMatrix* matrix, size_t* length);
+int dlmatrix_write(DlMatrix* matrix, const DinScore* scores, size_t positions);
+int dlmatrix_read(DlMatrix* matrix, DinScore* scores, size_t positions);
+int dlmatrix_skip(DlMatrix* matrix, size_t positions);
+long dlmatrix_tell(DlMatrix* matrix);
@@ -0,0 +1,196 @@
+#include "instrument.h"
+
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define PERF_EVENTS 4
+
+static const char* phase_names[INSTRUMENT_PHASES] = { "index", "dp", "logcoef", "root", "slope", "output" };
+static const char* counter_names[INSTRUMENT_COUNTERS] = { "windows", "delta_linking", "bisection", "exp", "logcoef_shift" };
+static const char* perf_names[PERF_EVENTS] = { "cycles", "instructions", "cache_misses", "branch_misses" };
+
+/* one cache line apart so threads don't share them */
+typedef struct {
+    uint64_t ns[INSTRUMENT_PHASES];
+    uint64_t count[INSTRUMENT_COUNTERS];
+    int perf_fd[PERF_EVENTS];
+} __attribute__((aligned(64))) ThreadStats;
+
+static ThreadStats* stats;
+static int nthreads;
+
+uint64_t instrument_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* counts the calling thread's user-space events from now on, -1 if unavailable */
+static int perf_open(int event)
+{
+#ifdef __linux__
+    static const uint64_t configs[PERF_EVENTS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = configs[event];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void)event;
+    return -1;
+#endif
+}
+
+static uint64_t perf_read(int fd)
+{
+    uint64_t value = 0;
+#ifdef __linux__
+    if (fd >= 0 && read(fd, &value, sizeof(value)) != sizeof(value)) {
+        value = 0;
+    }
+#endif
+    return value;
+}
+
+void instrument_init(void)
+{
+    nthreads = omp_get_max_threads();
+    stats = (ThreadStats*)aligned_alloc(64, nthreads * sizeof(ThreadStats));
+    memset(stats, 0, nthreads * sizeof(ThreadStats));
+
+    int perf = getenv("ZHUNT_PERF") != NULL;
+    #pragma omp parallel num_threads(nthreads)
+    {
+        ThreadStats* thread = &stats[omp_get_thread_num()];
+        for (int e = 0; e < PERF_EVENTS; e++) {
+            thread->perf_fd[e] = perf ? perf_open(e) : -1;
+        }
+    }
+}
+
+/* the calling thread's figures, NULL before instrument_init or on a thread
+   it didn't count on */
+static ThreadStats* thread_stats(void)
+{
+    int thread = omp_get_thread_num();
+    return (stats != NULL && thread < nthreads) ? &stats[thread] : NULL;
+}
+
+void instrument_time(int phase, uint64_t ns)
+{
+    ThreadStats* thread = thread_stats();
+    if (thread != NULL) {
+        thread->ns[phase] += ns;
+    }
+}
+
+void instrument_count(int counter, uint64_t n)
+{
+    ThreadStats* thread = thread_stats();
+    if (thread != NULL) {
+        thread->count[counter] += n;
+    }
+}
+
+static void dump_values(FILE* file, const char* key, const char** names, const uint64_t* values, int n)
+{
+    fprintf(file, "\"%s\": {", key);
+    for (int i = 0; i < n; i++) {
+        fprintf(file, "%s\"%s\": %lu", i ? ", " : "", names[i], (unsigned long)values[i]);
+    }
+    fprintf(file, "}");
+}
+
+/* writes the per-thread and total figures, then releases everything */
+void instrument_dump(void)
+{
+    if (stats == NULL) {
+        return;
+    }
+    const char* filename = getenv("ZHUNT_INSTRUMENT");
+    FILE* file = (filename != NULL) ? fopen(filename, "w") : stderr;
+    if (file == NULL) {
+        printf("couldn't open %s!\n", filename);
+        file = stderr;
+    }
+
+    uint64_t total_ns[INSTRUMENT_PHASES] = { 0 };
+    uint64_t total_count[INSTRUMENT_COUNTERS] = { 0 };
+    uint64_t total_perf[PERF_EVENTS] = { 0 };
+    uint64_t max_busy = 0, sum_busy = 0;
+    int busy_threads = 0;
+
+    fprintf(file, "{\n  \"threads\": [\n");
+    for (int t = 0; t < nthreads; t++) {
+        ThreadStats* thread = &stats[t];
+        uint64_t perf[PERF_EVENTS];
+        uint64_t busy = 0;
+        for (int p = 0; p < INSTRUMENT_PHASES; p++) {
+            total_ns[p] += thread->ns[p];
+            busy += thread->ns[p];
+        }
+        for (int c = 0; c < INSTRUMENT_COUNTERS; c++) {
+            total_count[c] += thread->count[c];
+        }
+        for (int e = 0; e < PERF_EVENTS; e++) {
+            perf[e] = perf_read(thread->perf_fd[e]);
+            total_perf[e] += perf[e];
+        }
+        if (busy > 0) {
+            busy_threads++;
+            sum_busy += busy;
+            max_busy = (busy > max_busy) ? busy : max_busy;
+        }
+
+        fprintf(file, "    {\"thread\": %d, ", t);
+        dump_values(file, "ns", phase_names, thread->ns, INSTRUMENT_PHASES);
+        fprintf(file, ", ");
+        dump_values(file, "counters", counter_names, thread->count, INSTRUMENT_COUNTERS);
+        if (thread->perf_fd[0] >= 0) {
+            fprintf(file, ", ");
+            dump_values(file, "perf", perf_names, perf, PERF_EVENTS);
+        }
+        fprintf(file, "}%s\n", (t + 1 < nthreads) ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"total\": {");
+    dump_values(file, "ns", phase_names, total_ns, INSTRUMENT_PHASES);
+    fprintf(file, ", ");
+    dump_values(file, "counters", counter_names, total_count, INSTRUMENT_COUNTERS);
+    if (stats[0].perf_fd[0] >= 0) {
+        fprintf(file, ", ");
+        dump_values(file, "perf", perf_names, total_perf, PERF_EVENTS);
+    }
+    /* busiest thread over the mean of the threads that did any work */
+    double imbalance = busy_threads ? (double)max_busy * busy_threads / sum_busy : 1.0;
+    fprintf(file, "},\n  \"imbalance\": %.3f\n}\n", imbalance);
+
+    if (file != stderr) {
+        fclose(file);
+    }
+#ifdef __linux__
+    for (int t = 0; t < nthreads; t++) {
+        for (int e = 0; e < PERF_EVENTS; e++) {
+            if (stats[t].perf_fd[e] >= 0) {
+                close(stats[t].perf_fd[e]);
+            }
+        }
+    }
+#endif
+    free(stats);
+    stats = NULL;
+}
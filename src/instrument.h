@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Hot-path timers and counters, compiled out unless built with -DINSTRUMENT
+   (make INSTRUMENT=1). Times and counts are kept per OpenMP thread and dumped
+   as JSON at the end of a run, to the file named by $ZHUNT_INSTRUMENT or to
+   stderr. With $ZHUNT_PERF set, hardware counters are read through
+   perf_event_open as well. */
+
+enum {
+    PHASE_INDEX, /* sequence decoding into bzindex windows */
+    PHASE_DP, /* best anti/syn conformation and its energies */
+    PHASE_LOGCOEF,
+    PHASE_ROOT, /* bisection for the delta linking */
+    PHASE_SLOPE, /* slope and probability of the best window size */
+    PHASE_OUTPUT,
+    INSTRUMENT_PHASES
+};
+
+enum {
+    COUNTER_WINDOWS,
+    COUNTER_DELTA_LINKING, /* evaluations of the delta linking function */
+    COUNTER_BISECTION, /* bisection iterations */
+    COUNTER_EXP,
+    COUNTER_LOGCOEF_SHIFT, /* coefficients updated from the window a dinucleotide back */
+    INSTRUMENT_COUNTERS
+};
+
+void instrument_init(void);
+void instrument_dump(void);
+uint64_t instrument_now(void);
+void instrument_time(int phase, uint64_t ns);
+void instrument_count(int counter, uint64_t n);
+
+#ifdef INSTRUMENT
+#define INSTRUMENT_INIT() instrument_init()
+#define INSTRUMENT_DUMP() instrument_dump()
+#define INSTRUMENT_BEGIN(phase) uint64_t instrument_##phase = instrument_now()
+#define INSTRUMENT_END(phase) instrument_time(phase, instrument_now() - instrument_##phase)
+#define INSTRUMENT_COUNT(counter, n) instrument_count(counter, n)
+#else
+#define INSTRUMENT_INIT() ((void)0)
+#define INSTRUMENT_DUMP() ((void)0)
+#define INSTRUMENT_BEGIN(phase) ((void)0)
+#define INSTRUMENT_END(phase) ((void)0)
+#define INSTRUMENT_COUNT(counter, n) ((void)0)
+#endif
@@ -0,0 +1,183 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "progress.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PROGRESS_INTERVAL 10.0 /* seconds between reports */
+
+int checkpoint_read(const char* filename, Checkpoint* checkpoint)
+{
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    int n = fscanf(file, "zhunt checkpoint 2 record %zu position %zu zscore %ld probability %ld matrix %ld windowsize %d min %d max %d showprobability %d sweep %d",
+        &checkpoint->record, &checkpoint->position, &checkpoint->zoffset, &checkpoint->poffset, &checkpoint->moffset,
+        &checkpoint->windowsize, &checkpoint->fromdin, &checkpoint->todin, &checkpoint->probability, &checkpoint->na);
+    if (n == 10 && (checkpoint->na < 1 || checkpoint->na > MAX_SWEEP)) {
+        n = 0;
+    }
+    for (int k = 0; n == 10 && k < checkpoint->na; k++) {
+        n -= fscanf(file, "%la", &checkpoint->a[k]) != 1;
+    }
+    fclose(file);
+    return (n == 10) ? 0 : -1;
+}
+
+/* replaces the checkpoint atomically, so a kill leaves either the old or the new one */
+int checkpoint_write(const char* filename, const Checkpoint* checkpoint)
+{
+    char* temporary = (char*)malloc(strlen(filename) + 5);
+    sprintf(temporary, "%s.tmp", filename);
+    FILE* file = fopen(temporary, "w");
+    if (file == NULL) {
+        free(temporary);
+        return -1;
+    }
+    fprintf(file, "zhunt checkpoint 2\nrecord %zu\nposition %zu\nzscore %ld\nprobability %ld\nmatrix %ld\nwindowsize %d\nmin %d\nmax %d\nshowprobability %d\nsweep %d",
+        checkpoint->record, checkpoint->position, checkpoint->zoffset, checkpoint->poffset, checkpoint->moffset,
+        checkpoint->windowsize, checkpoint->fromdin, checkpoint->todin, checkpoint->probability, checkpoint->na);
+    for (int k = 0; k < checkpoint->na; k++) {
+        fprintf(file, " %a", checkpoint->a[k]); /* exact */
+    }
+    fprintf(file, "\n");
+    int failed = fclose(file) != 0 || rename(temporary, filename) != 0;
+    free(temporary);
+    return failed ? -1 : 0;
+}
+
+/* whether the checkpoint was written by a run with the same parameters */
+int checkpoint_matches(const Checkpoint* checkpoint, const Checkpoint* run)
+{
+    return checkpoint->windowsize == run->windowsize && checkpoint->fromdin == run->fromdin
+        && checkpoint->todin == run->todin && checkpoint->probability == run->probability
+        && checkpoint->na == run->na && memcmp(checkpoint->a, run->a, run->na * sizeof(double)) == 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Why the run is stopping early, once it is; latched so that every thread
+   that looks agrees and the outputs end where the first one stopped. */
+static volatile sig_atomic_t signalled;
+static int stop_reason; /* 0, or an index into stop_reasons */
+static const char* stop_reasons[] = { NULL, "signal", "deadline", "budget" };
+static double deadline; /* 0 for none */
+static size_t budget; /* bases, 0 for none */
+
+static void catch_stop(int signal)
+{
+    (void)signal;
+    signalled = 1;
+}
+
+/* A run stops at its next chunk when it gets SIGTERM or SIGINT (a second one
+   kills it), 'seconds' from now or after scoring 'bases' bases, if not 0. */
+void progress_limit(double seconds, size_t bases)
+{
+    deadline = (seconds > 0.0) ? now() + seconds : 0.0;
+    budget = bases;
+    struct sigaction action = { .sa_handler = catch_stop, .sa_flags = SA_RESETHAND };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+}
+
+/* whether the run must stop now; may be called from any thread */
+int progress_stopped(const Progress* progress)
+{
+    int reason;
+    #pragma omp atomic read
+    reason = stop_reason;
+    if (reason == 0) {
+        size_t done;
+        #pragma omp atomic read
+        done = progress->done;
+        if (signalled) {
+            reason = 1;
+        } else if (deadline > 0.0 && now() >= deadline) {
+            reason = 2;
+        } else if (budget > 0 && done - progress->resumed >= budget) {
+            reason = 3;
+        }
+        if (reason != 0) {
+            #pragma omp critical(progress_stop)
+            if (stop_reason == 0) {
+                #pragma omp atomic write
+                stop_reason = reason;
+            }
+        }
+    }
+    return reason != 0;
+}
+
+/* what stopped the run early, NULL if nothing did */
+const char* progress_stop_reason(void)
+{
+    return stop_reasons[stop_reason];
+}
+
+void progress_init(Progress* progress, size_t total, size_t done, const char* statusfile)
+{
+    progress->total = total;
+    progress->done = progress->resumed = done;
+    progress->start = progress->last = now();
+    progress->reported = 0;
+    progress->statusfile = statusfile;
+}
+
+/* may be called from any thread */
+void progress_add(Progress* progress, size_t bases)
+{
+    #pragma omp atomic
+    progress->done += bases;
+}
+
+/* prints bases done, rate and ETA at most every PROGRESS_INTERVAL seconds;
+   the final report is only printed if an earlier one was */
+void progress_report(Progress* progress, int final)
+{
+    double t = now();
+    if (!final && t - progress->last < PROGRESS_INTERVAL) {
+        return;
+    }
+    if (final && !progress->reported && progress->statusfile == NULL) {
+        return;
+    }
+    progress->last = t;
+    progress->reported = 1;
+
+    size_t done;
+    #pragma omp atomic read
+    done = progress->done;
+    double elapsed = t - progress->start;
+    double rate = (elapsed > 0.0) ? (done - progress->resumed) / elapsed : 0.0;
+    long eta = (rate > 0.0) ? (long)((progress->total - done) / rate) : -1;
+
+    FILE* file = stderr;
+    if (progress->statusfile != NULL) {
+        file = fopen(progress->statusfile, "w");
+        if (file == NULL) {
+            return;
+        }
+    }
+    fprintf(file, "%s %zu/%zu bases (%.1f%%), %.0f bases/s, ", final ? "done" : "progress", done, progress->total,
+        progress->total ? 100.0 * done / progress->total : 100.0, rate);
+    if (eta >= 0) {
+        fprintf(file, "ETA %ld:%02ld:%02ld\n", eta / 3600, eta / 60 % 60, eta % 60);
+    } else {
+        fprintf(file, "ETA unknown\n");
+    }
+    if (file != stderr) {
+        fclose(file);
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "zscore.h"
+
+#include <stddef.h>
+
+/* where an interrupted run stopped: the outputs are complete up to the given
+   offsets, which hold every position before 'position' of sequence (or region)
+   'record' */
+typedef struct {
+    size_t record;
+    size_t position;
+    long zoffset;
+    long poffset;
+    long moffset; /* of the dl matrix, 0 if none */
+    int windowsize;
+    int fromdin;
+    int todin;
+    int probability;
+    int na;
+    double a[MAX_SWEEP];
+} Checkpoint;
+
+int checkpoint_read(const char* filename, Checkpoint* checkpoint);
+int checkpoint_write(const char* filename, const Checkpoint* checkpoint);
+int checkpoint_matches(const Checkpoint* checkpoint, const Checkpoint* run);
+
+typedef struct {
+    size_t total;
+    size_t done;
+    size_t resumed; /* done before this run started */
+    double start;
+    double last;
+    int reported;
+    const char* statusfile; /* NULL reports to stderr */
+} Progress;
+
+void progress_init(Progress* progress, size_t total, size_t done, const char* statusfile);
+void progress_limit(double seconds, size_t bases);
+int progress_stopped(const Progress* progress);
+const char* progress_stop_reason(void);
+void progress_add(Progress* progress, size_t bases);
+void progress_report(Progress* progress, int final);
@@ -0,0 +1,157 @@
+#include "records.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct RecordReader {
+    SeqFile* file;
+    char* text; /* unread input is text[start..end) */
+    size_t start;
+    size_t end;
+    size_t capacity;
+    int eof;
+    char type; /* '>' or '@' of the current record */
+    int held; /* the next FASTA header was read with the last record, into next */
+    char* name;
+    size_t namecapacity;
+    char* next;
+    size_t nextcapacity;
+    char* bases;
+    size_t length;
+    size_t basescapacity;
+};
+
+RecordReader* records_open(SeqFile* file)
+{
+    RecordReader* reader = (RecordReader*)calloc(1, sizeof(RecordReader));
+    reader->file = file;
+    reader->capacity = 1 << 16;
+    reader->text = (char*)malloc(reader->capacity);
+    return reader;
+}
+
+/* the next line, without its end of line, or NULL at the end of the input */
+static char* next_line(RecordReader* reader, size_t* length)
+{
+    for (;;) {
+        char* line = reader->text + reader->start;
+        char* newline = (char*)memchr(line, '\n', reader->end - reader->start);
+        if (newline != NULL || (reader->eof && reader->end > reader->start)) {
+            size_t n = ((newline != NULL) ? newline : reader->text + reader->end) - line;
+            reader->start += n + (newline != NULL);
+            if (n > 0 && line[n - 1] == '\r') {
+                n--;
+            }
+            line[n] = '\0';
+            *length = n;
+            return line;
+        }
+        if (reader->eof) {
+            return NULL;
+        }
+
+        const char* chunk;
+        size_t n = seqfile_read(reader->file, &chunk);
+        if (n == 0) {
+            reader->eof = 1;
+            continue;
+        }
+        memmove(reader->text, reader->text + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+        if (reader->capacity < reader->end + n + 1) { /* room for the last line's terminator */
+            reader->capacity = 2 * (reader->end + n + 1);
+            reader->text = (char*)realloc(reader->text, reader->capacity);
+        }
+        memcpy(reader->text + reader->end, chunk, n);
+        reader->end += n;
+    }
+}
+
+static void read_name(const char* header, char** name, size_t* capacity)
+{
+    size_t n = strcspn(header + 1, " \t");
+    if (*capacity < n + 1) {
+        *capacity = n + 1;
+        *name = (char*)realloc(*name, *capacity);
+    }
+    memcpy(*name, header + 1, n);
+    (*name)[n] = '\0';
+}
+
+static void append(RecordReader* reader, const char* line, size_t n)
+{
+    if (reader->basescapacity < reader->length + n) {
+        reader->basescapacity = 2 * (reader->length + n);
+        reader->bases = (char*)realloc(reader->bases, reader->basescapacity);
+    }
+    memcpy(reader->bases + reader->length, line, n);
+    reader->length += n;
+}
+
+/* returns 1 with the next record, 0 at the end of the input, -1 if it's malformed */
+int records_next(RecordReader* reader, Record* record)
+{
+    char* line;
+    size_t n;
+    if (!reader->held) {
+        do {
+            line = next_line(reader, &n);
+        } while (line != NULL && n == 0);
+        if (line == NULL) {
+            return 0;
+        }
+        if (line[0] != '>' && line[0] != '@') {
+            return -1;
+        }
+        read_name(line, &reader->name, &reader->namecapacity);
+        reader->type = line[0];
+    } else {
+        char* name = reader->name;
+        size_t capacity = reader->namecapacity;
+        reader->name = reader->next;
+        reader->namecapacity = reader->nextcapacity;
+        reader->next = name;
+        reader->nextcapacity = capacity;
+    }
+    reader->held = 0;
+    reader->length = 0;
+
+    if (reader->type == '>') {
+        while ((line = next_line(reader, &n)) != NULL) {
+            if (n > 0 && line[0] == '>') {
+                read_name(line, &reader->next, &reader->nextcapacity);
+                reader->held = 1;
+                break;
+            }
+            append(reader, line, n);
+        }
+    } else {
+        /* sequence lines up to the '+' line, then as many quality characters */
+        while ((line = next_line(reader, &n)) != NULL && !(n > 0 && line[0] == '+')) {
+            append(reader, line, n);
+        }
+        size_t quality = 0;
+        while (line != NULL && quality < reader->length && (line = next_line(reader, &n)) != NULL) {
+            quality += n;
+        }
+        if (line == NULL || quality != reader->length) {
+            return -1;
+        }
+    }
+
+    record->name = reader->name;
+    record->bases = reader->bases;
+    record->length = reader->length;
+    return 1;
+}
+
+void records_close(RecordReader* reader)
+{
+    free(reader->text);
+    free(reader->name);
+    free(reader->next);
+    free(reader->bases);
+    free(reader);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "seqfile.h"
+
+#include <stddef.h>
+
+/* FASTA and FASTQ records, one at a time as they arrive: a FASTA record is
+   complete when the next header or the end of the input comes, a FASTQ record
+   as soon as its qualities are in. A record is valid until the next one is read. */
+typedef struct {
+    const char* name; /* first word of the header */
+    const char* bases; /* the sequence lines, joined */
+    size_t length;
+} Record;
+
+typedef struct RecordReader RecordReader;
+
+RecordReader* records_open(SeqFile* file);
+int records_next(RecordReader* reader, Record* record);
+void records_close(RecordReader* reader);
@@ -0,0 +1,166 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "regions.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Random access into an uncompressed FASTA through its samtools faidx index:
+   each line of the .fai holds name, length, offset of the first base,
+   bases per line and bytes per line. The reference itself is mmapped. */
+
+static int compare_entries(const void* a, const void* b)
+{
+    return strcmp(((const FaiEntry*)a)->name, ((const FaiEntry*)b)->name);
+}
+
+static FaiEntry* read_fai(const char* filename, size_t* count)
+{
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    size_t capacity = 64;
+    FaiEntry* entries = (FaiEntry*)malloc(capacity * sizeof(FaiEntry));
+    char* line = NULL;
+    size_t linesize = 0;
+    *count = 0;
+    while (getline(&line, &linesize, file) != -1) {
+        char name[linesize];
+        FaiEntry entry;
+        if (sscanf(line, "%s %zu %zu %zu %zu", name, &entry.length, &entry.offset, &entry.linebases, &entry.linewidth) != 5 || entry.linebases == 0) {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity *= 2;
+            entries = (FaiEntry*)realloc(entries, capacity * sizeof(FaiEntry));
+        }
+        entry.name = strdup(name);
+        entries[(*count)++] = entry;
+    }
+    free(line);
+    fclose(file);
+
+    qsort(entries, *count, sizeof(FaiEntry), compare_entries);
+    return entries;
+}
+
+Reference* reference_open(const char* filename, const char* faifilename)
+{
+    size_t count;
+    FaiEntry* entries = read_fai(faifilename, &count);
+    if (entries == NULL) {
+        fprintf(stderr, "couldn't open index %s!\n", faifilename);
+        return NULL;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "couldn't open %s!\n", filename);
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(entries);
+        return NULL;
+    }
+    void* data = (st.st_size > 0) ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "couldn't map %s!\n", filename);
+        free(entries);
+        return NULL;
+    }
+    posix_madvise(data, st.st_size, POSIX_MADV_RANDOM);
+
+    Reference* reference = (Reference*)malloc(sizeof(Reference));
+    reference->entries = entries;
+    reference->count = count;
+    reference->data = (const char*)data;
+    reference->size = st.st_size;
+    return reference;
+}
+
+const FaiEntry* reference_find(const Reference* reference, const char* name)
+{
+    FaiEntry key = { .name = (char*)name };
+    return (const FaiEntry*)bsearch(&key, reference->entries, reference->count, sizeof(FaiEntry), compare_entries);
+}
+
+/* copies bases [start, end) of 'entry' plus 'flank' more, lowercased, into 'out';
+   past the end the sequence carries on from its start, as a whole file does */
+void reference_fetch(const Reference* reference, const FaiEntry* entry, size_t start, size_t end, size_t flank, char* out)
+{
+    size_t length = end - start;
+    for (size_t k = 0; k < length + flank; k++) {
+        size_t pos = start + k;
+        if (pos >= entry->length) {
+            pos = (pos - entry->length) % entry->length;
+        }
+        size_t offset = entry->offset + (pos / entry->linebases) * entry->linewidth + pos % entry->linebases;
+        out[k] = (offset < reference->size) ? (reference->data[offset] | 0x20) : 'n';
+    }
+}
+
+void reference_close(Reference* reference)
+{
+    munmap((void*)reference->data, reference->size);
+    for (size_t i = 0; i < reference->count; i++) {
+        free(reference->entries[i].name);
+    }
+    free(reference->entries);
+    free(reference);
+}
+
+Region* read_bed(const char* filename, size_t* count)
+{
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    size_t capacity = 64;
+    Region* regions = (Region*)malloc(capacity * sizeof(Region));
+    char* line = NULL;
+    size_t linesize = 0;
+    *count = 0;
+    while (getline(&line, &linesize, file) != -1) {
+        if (line[0] == '#' || strncmp(line, "track", 5) == 0 || strncmp(line, "browser", 7) == 0) {
+            continue;
+        }
+        char* chrom = strtok(line, " \t\r\n");
+        char* start = strtok(NULL, " \t\r\n");
+        char* end = strtok(NULL, " \t\r\n");
+        char* name = strtok(NULL, " \t\r\n");
+        if (chrom == NULL || start == NULL || end == NULL) {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity *= 2;
+            regions = (Region*)realloc(regions, capacity * sizeof(Region));
+        }
+        Region* region = &regions[(*count)++];
+        region->chrom = strdup(chrom);
+        region->start = strtoull(start, NULL, 10);
+        region->end = strtoull(end, NULL, 10);
+        region->name = (name != NULL) ? strdup(name) : NULL;
+    }
+    free(line);
+    fclose(file);
+    return regions;
+}
+
+void free_regions(Region* regions, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        free(regions[i].chrom);
+        free(regions[i].name);
+    }
+    free(regions);
+}
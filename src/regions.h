@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef struct {
+    char* name;
+    size_t length;
+    size_t offset;
+    size_t linebases;
+    size_t linewidth;
+} FaiEntry;
+
+typedef struct {
+    FaiEntry* entries;
+    size_t count;
+    const char* data;
+    size_t size;
+} Reference;
+
+typedef struct {
+    char* chrom;
+    size_t start;
+    size_t end;
+    char* name;
+} Region;
+
+Reference* reference_open(const char* filename, const char* faifilename);
+const FaiEntry* reference_find(const Reference* reference, const char* name);
+void reference_fetch(const Reference* reference, const FaiEntry* entry, size_t start, size_t end, size_t flank, char* out);
+void reference_close(Reference* reference);
+
+Region* read_bed(const char* filename, size_t* count);
+void free_regions(Region* regions, size_t count);
@@ -0,0 +1,353 @@
+#include "seqfile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Uncompressed files are memory-mapped and handed out MAP_CHUNK bytes at a
+   time, large enough for the parser to split between threads. Gzip files are
+   read through zlib. BGZF files (bgzip, samtools) are a series of independent gzip
+   members of at most 64 KiB each whose compressed size is stored in the
+   header, so a batch of them can be read sequentially and inflated in parallel.
+   Standard input ("-") is handed out as it arrives, whatever read() returns,
+   inflated first if it is gzip. */
+
+#define PLAIN_CHUNK (1 << 20)
+#define MAP_CHUNK (1 << 26)
+#define BGZF_BATCH 256 /* blocks inflated per batch */
+#define BGZF_FIXED_HEADER 12
+#define BGZF_MAX_BLOCK 65536
+
+struct SeqFile {
+    const char* map;
+    size_t mapsize;
+    size_t mapoffset;
+    gzFile gz;
+    FILE* bgzf;
+    char* buffer;
+    size_t capacity;
+    unsigned char* blocks;
+    size_t blocks_capacity;
+    int stream; /* reading standard input */
+    int sniffed; /* its first bytes were checked for gzip */
+    z_stream* inflater; /* of gzip standard input */
+    unsigned char* input;
+    int ended; /* the last gzip member is complete */
+    int error;
+};
+
+static uint16_t read_le16(const unsigned char* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_le32(const unsigned char* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* total size of the block whose header (and XLEN extra bytes) start at 'header', 0 if not BGZF */
+static size_t bgzf_block_size(const unsigned char* header, size_t available)
+{
+    if (available < BGZF_FIXED_HEADER || header[0] != 31 || header[1] != 139 || header[2] != 8 || (header[3] & 4) == 0) {
+        return 0;
+    }
+    size_t xlen = read_le16(header + 10);
+    if (available < BGZF_FIXED_HEADER + xlen) {
+        return 0;
+    }
+    const unsigned char* extra = header + BGZF_FIXED_HEADER;
+    for (size_t i = 0; i + 4 <= xlen; i += 4 + read_le16(extra + i + 2)) {
+        if (extra[i] == 'B' && extra[i + 1] == 'C' && read_le16(extra + i + 2) == 2 && i + 6 <= xlen) {
+            return (size_t)read_le16(extra + i + 4) + 1;
+        }
+    }
+    return 0;
+}
+
+static int is_bgzf(FILE* file)
+{
+    unsigned char header[BGZF_FIXED_HEADER + 0xffff];
+    size_t n = fread(header, 1, sizeof(header), file);
+    rewind(file);
+    return bgzf_block_size(header, n) != 0;
+}
+
+static SeqFile* open_stream(void)
+{
+    SeqFile* seqfile = (SeqFile*)calloc(1, sizeof(SeqFile));
+    seqfile->stream = 1;
+    seqfile->capacity = PLAIN_CHUNK;
+    seqfile->buffer = (char*)malloc(seqfile->capacity);
+    return seqfile;
+}
+
+SeqFile* seqfile_open(const char* filename)
+{
+    if (strcmp(filename, "-") == 0) {
+        return open_stream();
+    }
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    SeqFile* seqfile = (SeqFile*)calloc(1, sizeof(SeqFile));
+    if (is_bgzf(file)) {
+        seqfile->bgzf = file;
+        return seqfile;
+    }
+    unsigned char magic[2] = { 0 };
+    size_t nmagic = fread(magic, 1, 2, file);
+    struct stat st;
+    if ((nmagic < 2 || magic[0] != 31 || magic[1] != 139) && fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode)) {
+        /* not gzip: map it, an empty file needs no mapping */
+        seqfile->mapsize = st.st_size;
+        if (seqfile->mapsize == 0) {
+            fclose(file);
+            return seqfile;
+        }
+        void* map = mmap(NULL, seqfile->mapsize, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        fclose(file);
+        if (map == MAP_FAILED) {
+            free(seqfile);
+            return NULL;
+        }
+        madvise(map, seqfile->mapsize, MADV_SEQUENTIAL);
+        seqfile->map = (const char*)map;
+        return seqfile;
+    }
+    fclose(file);
+
+    seqfile->gz = gzopen(filename, "rb");
+    if (seqfile->gz == NULL) {
+        free(seqfile);
+        return NULL;
+    }
+    gzbuffer(seqfile->gz, PLAIN_CHUNK);
+    seqfile->capacity = PLAIN_CHUNK;
+    seqfile->buffer = (char*)malloc(seqfile->capacity);
+    return seqfile;
+}
+
+static int bgzf_inflate_block(const unsigned char* block, size_t size, char* out, size_t isize)
+{
+    size_t header = BGZF_FIXED_HEADER + read_le16(block + 10);
+    if (size < header + 8 || isize > BGZF_MAX_BLOCK) {
+        return -1;
+    }
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -15) != Z_OK) {
+        return -1;
+    }
+    zs.next_in = (Bytef*)(block + header);
+    zs.avail_in = (uInt)(size - header - 8);
+    zs.next_out = (Bytef*)out;
+    zs.avail_out = (uInt)isize;
+    int ret = inflate(&zs, Z_FINISH);
+    size_t produced = zs.total_out;
+    inflateEnd(&zs);
+
+    if (ret != Z_STREAM_END || produced != isize) {
+        return -1;
+    }
+    uint32_t crc = (uint32_t)crc32(crc32(0L, Z_NULL, 0), (const Bytef*)out, (uInt)isize);
+    return crc == read_le32(block + size - 8) ? 0 : -1;
+}
+
+static size_t bgzf_read(SeqFile* file, const char** data)
+{
+    size_t offset[BGZF_BATCH + 1];
+    size_t isize_offset[BGZF_BATCH + 1];
+    int nblocks = 0;
+
+    /* gather a batch of compressed blocks; only the headers are parsed here */
+    offset[0] = isize_offset[0] = 0;
+    while (nblocks < BGZF_BATCH) {
+        size_t used = offset[nblocks];
+        if (file->blocks_capacity < used + BGZF_MAX_BLOCK) {
+            file->blocks_capacity = used + BGZF_MAX_BLOCK;
+            file->blocks = (unsigned char*)realloc(file->blocks, file->blocks_capacity);
+        }
+        unsigned char* block = file->blocks + used;
+        size_t n = fread(block, 1, BGZF_FIXED_HEADER, file->bgzf);
+        if (n == 0) {
+            break;
+        }
+        size_t size = 0;
+        if (n == BGZF_FIXED_HEADER) {
+            size_t xlen = read_le16(block + 10);
+            if (xlen > BGZF_MAX_BLOCK - BGZF_FIXED_HEADER - 8) {
+                xlen = 0;
+            }
+            n += fread(block + BGZF_FIXED_HEADER, 1, xlen, file->bgzf);
+            size = bgzf_block_size(block, n);
+        }
+        if (size < n + 8 || fread(block + n, 1, size - n, file->bgzf) != size - n) {
+            fprintf(stderr, "seqfile: truncated or malformed BGZF block\n");
+            file->error = 1;
+            break;
+        }
+        offset[nblocks + 1] = used + size;
+        isize_offset[nblocks + 1] = isize_offset[nblocks] + read_le32(block + size - 4);
+        nblocks++;
+    }
+
+    size_t total = isize_offset[nblocks];
+    if (total > file->capacity) {
+        file->capacity = total;
+        file->buffer = (char*)realloc(file->buffer, file->capacity);
+    }
+
+    int failed = 0;
+    #pragma omp parallel for schedule(dynamic) reduction(| : failed)
+    for (int b = 0; b < nblocks; b++) {
+        failed |= bgzf_inflate_block(file->blocks + offset[b], offset[b + 1] - offset[b],
+            file->buffer + isize_offset[b], isize_offset[b + 1] - isize_offset[b]);
+    }
+    if (failed) {
+        fprintf(stderr, "seqfile: corrupt BGZF block\n");
+        file->error = 1;
+        return 0;
+    }
+
+    *data = file->buffer;
+    if (total == 0 && nblocks == BGZF_BATCH) {
+        /* a whole batch of empty blocks, keep going */
+        return bgzf_read(file, data);
+    }
+    return total;
+}
+
+static ssize_t read_input(SeqFile* file, void* buffer, size_t size)
+{
+    ssize_t n;
+    do {
+        n = read(STDIN_FILENO, buffer, size);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        fprintf(stderr, "seqfile: %s\n", strerror(errno));
+        file->error = 1;
+        return 0;
+    }
+    return n;
+}
+
+/* whatever standard input has, waiting only if it has nothing */
+static size_t stream_read(SeqFile* file, const char** data)
+{
+    *data = file->buffer;
+    if (file->inflater == NULL) {
+        ssize_t n = read_input(file, file->buffer, file->capacity);
+        if (file->sniffed || n < 2 || (unsigned char)file->buffer[0] != 31 || (unsigned char)file->buffer[1] != 139) {
+            file->sniffed = 1;
+            return n;
+        }
+        /* gzip, what was read is the start of the compressed input */
+        file->inflater = (z_stream*)calloc(1, sizeof(z_stream));
+        if (inflateInit2(file->inflater, 15 + 16) != Z_OK) {
+            file->error = 1;
+            return 0;
+        }
+        file->input = (unsigned char*)malloc(PLAIN_CHUNK);
+        memcpy(file->input, file->buffer, n);
+        file->inflater->next_in = file->input;
+        file->inflater->avail_in = n;
+    }
+
+    z_stream* z = file->inflater;
+    z->next_out = (Bytef*)file->buffer;
+    z->avail_out = (uInt)file->capacity;
+    while (z->avail_out == file->capacity) {
+        if (z->avail_in == 0) {
+            ssize_t n = read_input(file, file->input, PLAIN_CHUNK);
+            if (n == 0) {
+                if (!file->ended && !file->error) {
+                    fprintf(stderr, "seqfile: truncated gzip input\n");
+                    file->error = 1;
+                }
+                return 0;
+            }
+            z->next_in = file->input;
+            z->avail_in = (uInt)n;
+        }
+        int ret = inflate(z, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            inflateReset(z); /* gzip members may follow */
+            file->ended = 1;
+        } else if (ret == Z_OK) {
+            file->ended = 0;
+        } else if (ret != Z_BUF_ERROR) {
+            fprintf(stderr, "seqfile: corrupt gzip input\n");
+            file->error = 1;
+            return 0;
+        }
+    }
+    return file->capacity - z->avail_out;
+}
+
+/* returns the next chunk of uncompressed bytes, 0 at end of file or on error */
+size_t seqfile_read(SeqFile* file, const char** data)
+{
+    if (file->error) {
+        return 0;
+    }
+    if (file->bgzf != NULL) {
+        return bgzf_read(file, data);
+    }
+    if (file->stream) {
+        return stream_read(file, data);
+    }
+    if (file->gz == NULL) {
+        size_t n = file->mapsize - file->mapoffset;
+        n = (n < MAP_CHUNK) ? n : MAP_CHUNK;
+        *data = file->map + file->mapoffset;
+        file->mapoffset += n;
+        return n;
+    }
+
+    int n = gzread(file->gz, file->buffer, (unsigned)file->capacity);
+    if (n < 0) {
+        int errnum;
+        fprintf(stderr, "seqfile: %s\n", gzerror(file->gz, &errnum));
+        file->error = 1;
+        return 0;
+    }
+    *data = file->buffer;
+    return (size_t)n;
+}
+
+int seqfile_error(const SeqFile* file)
+{
+    return file->error;
+}
+
+void seqfile_close(SeqFile* file)
+{
+    if (file->bgzf != NULL) {
+        fclose(file->bgzf);
+    }
+    if (file->gz != NULL) {
+        gzclose(file->gz);
+    }
+    if (file->map != NULL) {
+        munmap((void*)file->map, file->mapsize);
+    }
+    if (file->inflater != NULL) {
+        inflateEnd(file->inflater);
+        free(file->inflater);
+        free(file->input);
+    }
+    free(file->blocks);
+    free(file->buffer);
+    free(file);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef struct SeqFile SeqFile;
+
+SeqFile* seqfile_open(const char* filename);
+size_t seqfile_read(SeqFile* file, const char** data);
+int seqfile_error(const SeqFile* file);
+void seqfile_close(SeqFile* file);
@@ -0,0 +1,407 @@
+#include "sequence.h"
+
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Bases are packed four to a byte, first base in the two most significant
+   bits, using the UCSC .2bit codes T=0, C=1, A=2, G=3, a quarter of a byte per
+   base and all that is kept of the sequence. sequence_load() decodes the range
+   a thread works on into two frames of dinucleotide indices: frame[0][k] for
+   bases 2k, 2k+1 and frame[1][k] for bases 2k+1, 2k+2, so every window is a
+   pointer into one of them. A view borrows packed bases from elsewhere (a
+   mmapped .2bit file) and has no circular tail of its own.
+   Ambiguous bases (N and the other IUPAC letters) keep their place in the
+   coordinates but are recorded as gaps, sorted [start, end) pairs in 'gaps',
+   and no window overlapping a gap is scored. */
+
+#define GAP 5
+#define SEQUENCE_NAME_MAX 256
+#define PACK_BLOCK 64 /* characters checked and packed at once */
+#define PARALLEL_APPEND (1 << 22) /* characters worth splitting between threads */
+
+/* packed code + 1 of each base, GAP for other letters, 0 for characters to skip */
+static const uint8_t base_code[256] = {
+    ['T'] = 1, ['C'] = 2, ['A'] = 3, ['G'] = 4,
+    ['t'] = 1, ['c'] = 2, ['a'] = 3, ['g'] = 4,
+    ['B'] = GAP, ['D'] = GAP, ['E'] = GAP, ['F'] = GAP, ['H'] = GAP, ['I'] = GAP, ['J'] = GAP,
+    ['K'] = GAP, ['L'] = GAP, ['M'] = GAP, ['N'] = GAP, ['O'] = GAP, ['P'] = GAP, ['Q'] = GAP,
+    ['R'] = GAP, ['S'] = GAP, ['U'] = GAP, ['V'] = GAP, ['W'] = GAP, ['X'] = GAP, ['Y'] = GAP, ['Z'] = GAP,
+    ['b'] = GAP, ['d'] = GAP, ['e'] = GAP, ['f'] = GAP, ['h'] = GAP, ['i'] = GAP, ['j'] = GAP,
+    ['k'] = GAP, ['l'] = GAP, ['m'] = GAP, ['n'] = GAP, ['o'] = GAP, ['p'] = GAP, ['q'] = GAP,
+    ['r'] = GAP, ['s'] = GAP, ['u'] = GAP, ['v'] = GAP, ['w'] = GAP, ['x'] = GAP, ['y'] = GAP, ['z'] = GAP
+};
+
+/* bzindex of a packed dinucleotide, the energy tables being ordered a, t, g, c */
+static const bzindex_t dinucleotide_index[16] = {
+    5, 7, 4, 6, /* tt tc ta tg */
+    13, 15, 12, 14, /* ct cc ca cg */
+    1, 3, 0, 2, /* at ac aa ag */
+    9, 11, 8, 10 /* gt gc ga gg */
+};
+
+static inline unsigned get_code(const uint8_t* packed, size_t i)
+{
+    return (packed[i >> 2] >> (6 - 2 * (i & 3))) & 3;
+}
+
+static inline void put_code(uint8_t* packed, size_t i, unsigned code)
+{
+    packed[i >> 2] |= (uint8_t)(code << (6 - 2 * (i & 3)));
+}
+
+/* makes room for 'bases' bases plus the zero byte read past the end by the frame kernel */
+static void reserve(Sequence* seq, size_t bases)
+{
+    size_t bytes = bases / 4 + 2;
+    if (bytes <= seq->capacity) {
+        return;
+    }
+    size_t capacity = seq->capacity ? seq->capacity : 1 << 14;
+    while (capacity < bytes) {
+        capacity *= 2;
+    }
+    seq->packed = (uint8_t*)realloc(seq->packed, capacity);
+    memset(seq->packed + seq->capacity, 0, capacity - seq->capacity);
+    seq->capacity = capacity;
+}
+
+Sequence* sequence_new(void)
+{
+    Sequence* seq = (Sequence*)calloc(1, sizeof(Sequence));
+    seq->linestart = 1;
+    reserve(seq, 0);
+    return seq;
+}
+
+/* a sequence over 'length' packed bases owned by the caller, circular over 'tail' more */
+Sequence* sequence_view(const uint8_t* packed, size_t length, size_t tail)
+{
+    Sequence* seq = (Sequence*)calloc(1, sizeof(Sequence));
+    seq->packed = (uint8_t*)packed;
+    seq->length = length;
+    seq->tail = tail;
+    return seq;
+}
+
+/* packed code of an A, C, G or T of either case: bits 1-2 of the letter give
+   A=0, C=1, T=2, G=3, which the exclusive or turns into A=2, T=0 */
+static inline unsigned letter_code(unsigned char c)
+{
+    unsigned x = (c >> 1) & 3;
+    return x ^ ((~x & 1) << 1);
+}
+
+/* whether the n characters are all A, C, G or T of either case */
+static int plain_bases(const char* text, size_t n)
+{
+    unsigned other = 0;
+    #pragma omp simd reduction(| : other)
+    for (size_t j = 0; j < n; j++) {
+        unsigned char c = text[j] | 0x20;
+        other |= (c != 'a') & (c != 'c') & (c != 'g') & (c != 't');
+    }
+    return !other;
+}
+
+/* packs n plain bases, n a multiple of 4, into whole bytes */
+static void pack_bases(const char* text, size_t n, uint8_t* packed)
+{
+    const unsigned char* t = (const unsigned char*)text;
+    #pragma omp simd
+    for (size_t k = 0; k < n / 4; k++) {
+        packed[k] = (uint8_t)(letter_code(t[4 * k]) << 6 | letter_code(t[4 * k + 1]) << 4
+            | letter_code(t[4 * k + 2]) << 2 | letter_code(t[4 * k + 3]));
+    }
+}
+
+/* Appends the characters of a sequence line, newline excluded. Byte aligned
+   blocks of plain bases, nearly all of them, are checked and packed whole;
+   anything else goes through the table one character at a time. */
+static void append_bases(Sequence* seq, const char* text, size_t n)
+{
+    uint8_t* packed = seq->packed;
+    size_t length = seq->length;
+    size_t j = 0;
+    while (j < n) {
+        size_t m = 1;
+        if ((length & 3) == 0 && n - j >= 4) {
+            m = (n - j < PACK_BLOCK) ? (n - j) & ~(size_t)3 : PACK_BLOCK;
+            if (plain_bases(text + j, m)) {
+                pack_bases(text + j, m, packed + length / 4);
+                j += m;
+                length += m;
+                continue;
+            }
+        }
+        for (size_t end = j + m; j < end; j++) {
+            unsigned code = base_code[(unsigned char)text[j]];
+            if (code == GAP) {
+                sequence_add_gap(seq, length++, 1);
+            } else if (code != 0) {
+                put_code(packed, length++, code - 1);
+            }
+        }
+    }
+    seq->length = length;
+}
+
+/* skips a header line (from its '>' or ';' if it starts in 'text'), keeping the
+   first word of the first FASTA header as the sequence's name */
+static const char* append_header(Sequence* seq, const char* text, const char* end)
+{
+    if (!seq->header) {
+        seq->header = 1;
+        if (*text == '>' && seq->name == NULL) {
+            seq->name = (char*)calloc(SEQUENCE_NAME_MAX, 1);
+            seq->namelength = 1; /* one more than the characters read */
+        }
+        text++;
+    }
+    const char* newline = (const char*)memchr(text, '\n', end - text);
+    const char* lineend = (newline != NULL) ? newline : end;
+    for (; seq->namelength != 0 && text < lineend; text++) {
+        if (*text == ' ' || *text == '\t' || *text == '\r') {
+            seq->namelength = 0;
+        } else if (seq->namelength < SEQUENCE_NAME_MAX) {
+            seq->name[seq->namelength++ - 1] = *text;
+        }
+    }
+    if (newline == NULL) {
+        return end;
+    }
+    seq->namelength = 0;
+    seq->header = 0;
+    seq->linestart = 1;
+    return newline + 1;
+}
+
+static void append_text(Sequence* seq, const char* text, size_t n)
+{
+    reserve(seq, seq->length + n);
+    const char* end = text + n;
+    while (text < end) {
+        if (seq->header || (seq->linestart && (*text == '>' || *text == ';'))) {
+            text = append_header(seq, text, end);
+            continue;
+        }
+        const char* newline = (const char*)memchr(text, '\n', end - text);
+        const char* lineend = (newline != NULL) ? newline : end;
+        append_bases(seq, text, lineend - text);
+        seq->linestart = (newline != NULL);
+        text = (newline != NULL) ? newline + 1 : end;
+    }
+}
+
+/* appends 'part', parsed separately from text that followed the sequence's,
+   taking over its gaps, name and parser state */
+static void join(Sequence* seq, Sequence* part)
+{
+    size_t length = seq->length;
+    reserve(seq, length + part->length);
+    size_t nbytes = (part->length + 3) / 4;
+    unsigned shift = 2 * (length & 3);
+    uint8_t* packed = seq->packed + length / 4;
+    if (shift == 0) {
+        memcpy(packed, part->packed, nbytes);
+    } else {
+        for (size_t j = 0; j < nbytes; j++) {
+            packed[j] |= part->packed[j] >> shift;
+            packed[j + 1] |= (uint8_t)(part->packed[j] << (8 - shift));
+        }
+    }
+    for (size_t g = 0; g < part->ngaps; g++) {
+        sequence_add_gap(seq, length + part->gaps[2 * g], part->gaps[2 * g + 1] - part->gaps[2 * g]);
+    }
+    seq->length = length + part->length;
+    seq->header = part->header;
+    seq->linestart = part->linestart;
+    if (seq->name == NULL && part->name != NULL) {
+        seq->name = part->name;
+        seq->namelength = part->namelength;
+        part->name = NULL;
+    }
+}
+
+/* Appends the bases in 'text', which may be split anywhere; FASTA header
+   lines, white space and other non-letters are skipped. Large texts are cut
+   at line starts into one part per thread, parsed in parallel and joined. */
+void sequence_append(Sequence* seq, const char* text, size_t n)
+{
+    int nparts = omp_get_max_threads();
+    const char* newline = (const char*)memchr(text, '\n', n);
+    if (n < PARALLEL_APPEND || nparts < 2 || newline == NULL) {
+        append_text(seq, text, n);
+        return;
+    }
+    /* the line under way continues here */
+    size_t head = newline + 1 - text;
+    append_text(seq, text, head);
+    text += head;
+    n -= head;
+
+    size_t cut[nparts + 1];
+    cut[0] = 0;
+    for (int p = 1; p < nparts; p++) {
+        size_t c = n / nparts * p;
+        c = (c < cut[p - 1]) ? cut[p - 1] : c;
+        const char* next = (const char*)memchr(text + c, '\n', n - c);
+        cut[p] = (next != NULL) ? (size_t)(next + 1 - text) : n;
+    }
+    cut[nparts] = n;
+
+    Sequence* parts[nparts];
+    #pragma omp parallel for schedule(static, 1)
+    for (int p = 0; p < nparts; p++) {
+        parts[p] = sequence_new();
+        append_text(parts[p], text + cut[p], cut[p + 1] - cut[p]);
+    }
+    for (int p = 0; p < nparts; p++) {
+        join(seq, parts[p]);
+        sequence_free(parts[p]);
+    }
+}
+
+/* marks bases [start, start + n) as ambiguous; gaps must be added in order */
+void sequence_add_gap(Sequence* seq, size_t start, size_t n)
+{
+    if (n == 0) {
+        return;
+    }
+    if (seq->ngaps > 0 && seq->gaps[2 * seq->ngaps - 1] >= start) {
+        size_t* end = &seq->gaps[2 * seq->ngaps - 1];
+        if (start + n > *end) {
+            *end = start + n;
+        }
+        return;
+    }
+    if (seq->ngaps == seq->gapcapacity) {
+        seq->gapcapacity = seq->gapcapacity ? 2 * seq->gapcapacity : 64;
+        seq->gaps = (size_t*)realloc(seq->gaps, 2 * seq->gapcapacity * sizeof(size_t));
+    }
+    seq->gaps[2 * seq->ngaps] = start;
+    seq->gaps[2 * seq->ngaps + 1] = start + n;
+    seq->ngaps++;
+}
+
+/* whether [start, end) of the linear sequence overlaps a gap */
+static int overlaps_gap(const Sequence* seq, size_t start, size_t end)
+{
+    size_t lo = 0, hi = seq->ngaps;
+    while (lo < hi) { /* first gap ending after start */
+        size_t mid = (lo + hi) / 2;
+        if (seq->gaps[2 * mid + 1] <= start) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < seq->ngaps && seq->gaps[2 * lo] < end;
+}
+
+/* whether any of bases [start, start + n) is ambiguous, wrapping past the end */
+int sequence_has_gap(const Sequence* seq, size_t start, size_t n)
+{
+    if (seq->ngaps == 0) {
+        return 0;
+    }
+    size_t end = start + n;
+    if (end <= seq->length) {
+        return overlaps_gap(seq, start, end);
+    }
+    if (start < seq->length && overlaps_gap(seq, start, seq->length)) {
+        return 1;
+    }
+    size_t wrapped = end - seq->length;
+    return overlaps_gap(seq, 0, wrapped < seq->length ? wrapped : seq->length);
+}
+
+/* each packed byte and the first base of the next one hold two dinucleotides of each frame */
+static void build_frames(const uint8_t* packed, size_t nbytes, bzindex_t* even, bzindex_t* odd)
+{
+    #pragma omp parallel for schedule(static) if (nbytes > (1 << 16))
+    for (size_t j = 0; j < nbytes; j++) {
+        unsigned w = ((unsigned)packed[j] << 8) | packed[j + 1];
+        even[2 * j] = dinucleotide_index[(w >> 12) & 15];
+        even[2 * j + 1] = dinucleotide_index[(w >> 8) & 15];
+        odd[2 * j] = dinucleotide_index[(w >> 10) & 15];
+        odd[2 * j + 1] = dinucleotide_index[(w >> 6) & 15];
+    }
+}
+
+/* repeats the first 'tail' bases after the end (the sequence is assumed circular) */
+void sequence_finish(Sequence* seq, size_t tail)
+{
+    reserve(seq, seq->length + tail);
+    for (size_t k = 0; k < tail && seq->length > 0; k++) {
+        put_code(seq->packed, seq->length + k, get_code(seq->packed, k % seq->length));
+    }
+    seq->tail = tail;
+}
+
+char sequence_base(const Sequence* seq, size_t i)
+{
+    if (i >= seq->length && seq->length > 0) {
+        i %= seq->length;
+    }
+    if (sequence_has_gap(seq, i, 1)) {
+        return 'n';
+    }
+    return "tcag"[get_code(seq->packed, i)];
+}
+
+void sequence_bases(const Sequence* seq, size_t i, size_t n, char* out)
+{
+    for (size_t k = 0; k < n; k++) {
+        out[k] = sequence_base(seq, i + k);
+    }
+}
+
+void sequence_free(Sequence* seq)
+{
+    if (seq->capacity != 0) {
+        free(seq->packed);
+    }
+    free(seq->gaps);
+    free(seq->name);
+    free(seq);
+}
+
+/* makes the windows starting in [start, start + bases - 2 * todin] available
+   through sequence_chunk_window(); the range may run past the end, into the
+   circular tail */
+void sequence_load(const Sequence* seq, size_t start, size_t bases, SequenceChunk* chunk)
+{
+    size_t origin = start & ~(size_t)3;
+    size_t nbytes = (start + bases - origin + 3) / 4;
+    if (chunk->capacity < nbytes + 1) {
+        chunk->capacity = nbytes + 1;
+        chunk->packed = (uint8_t*)realloc(chunk->packed, chunk->capacity);
+        chunk->buffer[0] = (bzindex_t*)realloc(chunk->buffer[0], 2 * chunk->capacity);
+        chunk->buffer[1] = (bzindex_t*)realloc(chunk->buffer[1], 2 * chunk->capacity);
+    }
+
+    const uint8_t* packed = seq->packed + origin / 4;
+    /* a finished sequence holds its tail, and reserve() a byte to spare after it */
+    int stored = (seq->capacity != 0) ? start + bases <= seq->length + seq->tail : origin + 4 * (nbytes + 1) <= seq->length;
+    if (!stored) {
+        /* the range runs into a circular tail that isn't there, copy it base by base */
+        memset(chunk->packed, 0, nbytes + 1);
+        for (size_t k = 0; k < 4 * nbytes; k++) {
+            size_t i = (origin + k) % seq->length;
+            put_code(chunk->packed, k, get_code(seq->packed, i));
+        }
+        packed = chunk->packed;
+    }
+    build_frames(packed, nbytes, chunk->buffer[0], chunk->buffer[1]);
+    chunk->origin = origin;
+    chunk->frame[0] = chunk->buffer[0];
+    chunk->frame[1] = chunk->buffer[1];
+}
+
+void sequence_chunk_free(SequenceChunk* chunk)
+{
+    free(chunk->packed);
+    free(chunk->buffer[0]);
+    free(chunk->buffer[1]);
+}
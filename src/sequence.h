@@ -0,0 +1,48 @@
+#pragma once
+
+#include "antisyn.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    size_t length;
+    size_t tail;
+    size_t capacity;
+    uint8_t* packed;
+    size_t ngaps;
+    size_t gapcapacity;
+    size_t* gaps;
+    int header;
+    int linestart;
+    char* name; /* first word of the first FASTA header, or NULL */
+    size_t namelength; /* while it is being read, 0 once complete */
+} Sequence;
+
+typedef struct {
+    size_t origin;
+    const bzindex_t* frame[2];
+    bzindex_t* buffer[2];
+    uint8_t* packed;
+    size_t capacity;
+} SequenceChunk;
+
+Sequence* sequence_new(void);
+Sequence* sequence_view(const uint8_t* packed, size_t length, size_t tail);
+void sequence_append(Sequence* seq, const char* text, size_t n);
+void sequence_finish(Sequence* seq, size_t tail);
+void sequence_add_gap(Sequence* seq, size_t start, size_t n);
+int sequence_has_gap(const Sequence* seq, size_t start, size_t n);
+char sequence_base(const Sequence* seq, size_t i);
+void sequence_bases(const Sequence* seq, size_t i, size_t n, char* out);
+void sequence_free(Sequence* seq);
+
+void sequence_load(const Sequence* seq, size_t start, size_t bases, SequenceChunk* chunk);
+void sequence_chunk_free(SequenceChunk* chunk);
+
+/* the todin dinucleotide indices of the window starting at base i, inside the
+   range last loaded into 'chunk' */
+static inline const bzindex_t* sequence_chunk_window(const SequenceChunk* chunk, size_t i)
+{
+    return chunk->frame[i & 1] + ((i - chunk->origin) >> 1);
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+/* Window sizes (in dinucleotides) whose kernels are compiled separately with
+   the size as a constant, so that their arrays have a fixed size and their
+   loops can be unrolled; other sizes take the generic path. The range can be
+   set at build time, e.g. make SPECIALIZE_MIN=8 SPECIALIZE_MAX=16, within
+   1..SPECIALIZE_LIMIT. */
+
+#ifndef SPECIALIZE_MIN
+#define SPECIALIZE_MIN 6
+#endif
+#ifndef SPECIALIZE_MAX
+#define SPECIALIZE_MAX 24
+#endif
+#define SPECIALIZE_LIMIT 32
+
+#define SPECIALIZED(n) ((n) >= SPECIALIZE_MIN && (n) <= SPECIALIZE_MAX)
+
+/* X(n) for every size in SPECIALIZE_MIN..SPECIALIZE_MAX, so that only those
+   kernels are compiled */
+#if SPECIALIZED(1)
+#define SPECIALIZE_1(X) X(1)
+#else
+#define SPECIALIZE_1(X)
+#endif
+#if SPECIALIZED(2)
+#define SPECIALIZE_2(X) X(2)
+#else
+#define SPECIALIZE_2(X)
+#endif
+#if SPECIALIZED(3)
+#define SPECIALIZE_3(X) X(3)
+#else
+#define SPECIALIZE_3(X)
+#endif
+#if SPECIALIZED(4)
+#define SPECIALIZE_4(X) X(4)
+#else
+#define SPECIALIZE_4(X)
+#endif
+#if SPECIALIZED(5)
+#define SPECIALIZE_5(X) X(5)
+#else
+#define SPECIALIZE_5(X)
+#endif
+#if SPECIALIZED(6)
+#define SPECIALIZE_6(X) X(6)
+#else
+#define SPECIALIZE_6(X)
+#endif
+#if SPECIALIZED(7)
+#define SPECIALIZE_7(X) X(7)
+#else
+#define SPECIALIZE_7(X)
+#endif
+#if SPECIALIZED(8)
+#define SPECIALIZE_8(X) X(8)
+#else
+#define SPECIALIZE_8(X)
+#endif
+#if SPECIALIZED(9)
+#define SPECIALIZE_9(X) X(9)
+#else
+#define SPECIALIZE_9(X)
+#endif
+#if SPECIALIZED(10)
+#define SPECIALIZE_10(X) X(10)
+#else
+#define SPECIALIZE_10(X)
+#endif
+#if SPECIALIZED(11)
+#define SPECIALIZE_11(X) X(11)
+#else
+#define SPECIALIZE_11(X)
+#endif
+#if SPECIALIZED(12)
+#define SPECIALIZE_12(X) X(12)
+#else
+#define SPECIALIZE_12(X)
+#endif
+#if SPECIALIZED(13)
+#define SPECIALIZE_13(X) X(13)
+#else
+#define SPECIALIZE_13(X)
+#endif
+#if SPECIALIZED(14)
+#define SPECIALIZE_14(X) X(14)
+#else
+#define SPECIALIZE_14(X)
+#endif
+#if SPECIALIZED(15)
+#define SPECIALIZE_15(X) X(15)
+#else
+#define SPECIALIZE_15(X)
+#endif
+#if SPECIALIZED(16)
+#define SPECIALIZE_16(X) X(16)
+#else
+#define SPECIALIZE_16(X)
+#endif
+#if SPECIALIZED(17)
+#define SPECIALIZE_17(X) X(17)
+#else
+#define SPECIALIZE_17(X)
+#endif
+#if SPECIALIZED(18)
+#define SPECIALIZE_18(X) X(18)
+#else
+#define SPECIALIZE_18(X)
+#endif
+#if SPECIALIZED(19)
+#define SPECIALIZE_19(X) X(19)
+#else
+#define SPECIALIZE_19(X)
+#endif
+#if SPECIALIZED(20)
+#define SPECIALIZE_20(X) X(20)
+#else
+#define SPECIALIZE_20(X)
+#endif
+#if SPECIALIZED(21)
+#define SPECIALIZE_21(X) X(21)
+#else
+#define SPECIALIZE_21(X)
+#endif
+#if SPECIALIZED(22)
+#define SPECIALIZE_22(X) X(22)
+#else
+#define SPECIALIZE_22(X)
+#endif
+#if SPECIALIZED(23)
+#define SPECIALIZE_23(X) X(23)
+#else
+#define SPECIALIZE_23(X)
+#endif
+#if SPECIALIZED(24)
+#define SPECIALIZE_24(X) X(24)
+#else
+#define SPECIALIZE_24(X)
+#endif
+#if SPECIALIZED(25)
+#define SPECIALIZE_25(X) X(25)
+#else
+#define SPECIALIZE_25(X)
+#endif
+#if SPECIALIZED(26)
+#define SPECIALIZE_26(X) X(26)
+#else
+#define SPECIALIZE_26(X)
+#endif
+#if SPECIALIZED(27)
+#define SPECIALIZE_27(X) X(27)
+#else
+#define SPECIALIZE_27(X)
+#endif
+#if SPECIALIZED(28)
+#define SPECIALIZE_28(X) X(28)
+#else
+#define SPECIALIZE_28(X)
+#endif
+#if SPECIALIZED(29)
+#define SPECIALIZE_29(X) X(29)
+#else
+#define SPECIALIZE_29(X)
+#endif
+#if SPECIALIZED(30)
+#define SPECIALIZE_30(X) X(30)
+#else
+#define SPECIALIZE_30(X)
+#endif
+#if SPECIALIZED(31)
+#define SPECIALIZE_31(X) X(31)
+#else
+#define SPECIALIZE_31(X)
+#endif
+#if SPECIALIZED(32)
+#define SPECIALIZE_32(X) X(32)
+#else
+#define SPECIALIZE_32(X)
+#endif
+#define SPECIALIZE_SIZES(X)                                             \
+    SPECIALIZE_1(X) SPECIALIZE_2(X) SPECIALIZE_3(X) SPECIALIZE_4(X)     \
+    SPECIALIZE_5(X) SPECIALIZE_6(X) SPECIALIZE_7(X) SPECIALIZE_8(X)     \
+    SPECIALIZE_9(X) SPECIALIZE_10(X) SPECIALIZE_11(X) SPECIALIZE_12(X)  \
+    SPECIALIZE_13(X) SPECIALIZE_14(X) SPECIALIZE_15(X) SPECIALIZE_16(X) \
+    SPECIALIZE_17(X) SPECIALIZE_18(X) SPECIALIZE_19(X) SPECIALIZE_20(X) \
+    SPECIALIZE_21(X) SPECIALIZE_22(X) SPECIALIZE_23(X) SPECIALIZE_24(X) \
+    SPECIALIZE_25(X) SPECIALIZE_26(X) SPECIALIZE_27(X) SPECIALIZE_28(X) \
+    SPECIALIZE_29(X) SPECIALIZE_30(X) SPECIALIZE_31(X) SPECIALIZE_32(X)
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
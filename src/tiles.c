@@ -0,0 +1,210 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "tiles.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Every position of a sequence is added in order, so the bins of a level are
+   dense. A finished bin is merged into the level above, which is finished in
+   turn by every second one; each level goes to its own temporary file until
+   the sequence ends. */
+
+#define TILE_MAGIC "ZHTILES1"
+#define TILE_FIRST_SHIFT 4 /* 16 bases per bin at the finest level */
+#define TILE_LEVELS 48
+#define TILE_BIN_SIZE 28
+
+typedef struct {
+    double min[2];
+    double max[2];
+    double sum[2];
+    uint32_t count;
+} Bin;
+
+typedef struct {
+    FILE* file;
+    uint64_t nbins;
+    Bin bin;
+} Level;
+
+typedef struct {
+    char* name;
+    uint64_t length;
+    uint32_t nlevels;
+    uint64_t offset[TILE_LEVELS];
+    uint64_t nbins[TILE_LEVELS];
+} Section;
+
+struct Tiles {
+    FILE* file;
+    Level levels[TILE_LEVELS];
+    int nlevels;
+    uint64_t position;
+    Section* sections;
+    size_t nsections;
+    size_t capacity;
+};
+
+static void bin_reset(Bin* bin)
+{
+    for (int v = 0; v < 2; v++) {
+        bin->min[v] = INFINITY;
+        bin->max[v] = -INFINITY;
+        bin->sum[v] = 0.0;
+    }
+    bin->count = 0;
+}
+
+static void bin_merge(Bin* bin, const Bin* other)
+{
+    for (int v = 0; v < 2; v++) {
+        bin->min[v] = (other->min[v] < bin->min[v]) ? other->min[v] : bin->min[v];
+        bin->max[v] = (other->max[v] > bin->max[v]) ? other->max[v] : bin->max[v];
+        bin->sum[v] += other->sum[v];
+    }
+    bin->count += other->count;
+}
+
+Tiles* tiles_open(const char* filename)
+{
+    Tiles* tiles = (Tiles*)calloc(1, sizeof(Tiles));
+    tiles->file = fopen(filename, "wb");
+    if (tiles->file == NULL) {
+        free(tiles);
+        return NULL;
+    }
+    fwrite(TILE_MAGIC, 1, strlen(TILE_MAGIC), tiles->file);
+    return tiles;
+}
+
+static void finish_bin(Tiles* tiles, int k)
+{
+    Level* level = &tiles->levels[k];
+    const Bin* bin = &level->bin;
+    float values[6];
+    for (int v = 0; v < 2; v++) {
+        values[3 * v] = bin->count ? (float)bin->min[v] : NAN;
+        values[3 * v + 1] = bin->count ? (float)bin->max[v] : NAN;
+        values[3 * v + 2] = bin->count ? (float)(bin->sum[v] / bin->count) : NAN;
+    }
+    fwrite(values, sizeof(values), 1, level->file);
+    fwrite(&bin->count, sizeof(bin->count), 1, level->file);
+    level->nbins++;
+    if (k + 1 < tiles->nlevels) {
+        bin_merge(&tiles->levels[k + 1].bin, bin);
+        if (level->nbins % 2 == 0) {
+            finish_bin(tiles, k + 1);
+        }
+    }
+    bin_reset(&level->bin);
+}
+
+/* finishes the partial bins and moves the levels to the file */
+static void finish_section(Tiles* tiles)
+{
+    if (tiles->nlevels == 0) {
+        return;
+    }
+    Section* section = &tiles->sections[tiles->nsections - 1];
+    for (int k = 0; k < tiles->nlevels; k++) {
+        uint64_t size = (uint64_t)1 << (TILE_FIRST_SHIFT + k);
+        if (tiles->levels[k].nbins < (section->length + size - 1) / size) {
+            finish_bin(tiles, k);
+        }
+    }
+    char copy[1 << 16];
+    for (int k = 0; k < tiles->nlevels; k++) {
+        Level* level = &tiles->levels[k];
+        section->offset[k] = ftello(tiles->file);
+        section->nbins[k] = level->nbins;
+        rewind(level->file);
+        size_t n;
+        while ((n = fread(copy, 1, sizeof(copy), level->file)) > 0) {
+            fwrite(copy, 1, n, tiles->file);
+        }
+        fclose(level->file);
+        level->file = NULL;
+    }
+    tiles->nlevels = 0;
+}
+
+/* starts a sequence; its 'length' positions must all be added */
+void tiles_begin(Tiles* tiles, const char* name, size_t length)
+{
+    finish_section(tiles);
+    if (tiles->nsections == tiles->capacity) {
+        tiles->capacity = tiles->capacity ? 2 * tiles->capacity : 64;
+        tiles->sections = (Section*)realloc(tiles->sections, tiles->capacity * sizeof(Section));
+    }
+    Section* section = &tiles->sections[tiles->nsections++];
+    memset(section, 0, sizeof(Section));
+    section->name = strdup(name);
+    section->length = length;
+
+    /* levels up to the one whose single bin covers the sequence */
+    int nlevels = 1;
+    while (nlevels < TILE_LEVELS && ((uint64_t)1 << (TILE_FIRST_SHIFT + nlevels - 1)) < length) {
+        nlevels++;
+    }
+    section->nlevels = nlevels;
+    tiles->nlevels = nlevels;
+    tiles->position = 0;
+    for (int k = 0; k < nlevels; k++) {
+        tiles->levels[k].file = tmpfile();
+        tiles->levels[k].nbins = 0;
+        bin_reset(&tiles->levels[k].bin);
+    }
+}
+
+/* the scores of the next position, NaN if it has none */
+void tiles_add(Tiles* tiles, double dl, double probability)
+{
+    Bin* bin = &tiles->levels[0].bin;
+    if (!isnan(dl)) {
+        double values[2] = { dl, probability };
+        for (int v = 0; v < 2; v++) {
+            bin->min[v] = (values[v] < bin->min[v]) ? values[v] : bin->min[v];
+            bin->max[v] = (values[v] > bin->max[v]) ? values[v] : bin->max[v];
+            bin->sum[v] += values[v];
+        }
+        bin->count++;
+    }
+    tiles->position++;
+    if ((tiles->position & (((uint64_t)1 << TILE_FIRST_SHIFT) - 1)) == 0) {
+        finish_bin(tiles, 0);
+    }
+}
+
+/* writes the directory; returns nonzero if the file couldn't be written */
+int tiles_close(Tiles* tiles)
+{
+    finish_section(tiles);
+    FILE* file = tiles->file;
+    uint64_t directory = ftello(file);
+    uint32_t nsections = tiles->nsections;
+    fwrite(&nsections, sizeof(nsections), 1, file);
+    for (size_t s = 0; s < tiles->nsections; s++) {
+        Section* section = &tiles->sections[s];
+        uint32_t namelength = strlen(section->name), shift = TILE_FIRST_SHIFT;
+        fwrite(&namelength, sizeof(namelength), 1, file);
+        fwrite(section->name, 1, namelength, file);
+        fwrite(&section->length, sizeof(section->length), 1, file);
+        fwrite(&shift, sizeof(shift), 1, file);
+        fwrite(&section->nlevels, sizeof(section->nlevels), 1, file);
+        for (uint32_t k = 0; k < section->nlevels; k++) {
+            fwrite(&section->offset[k], sizeof(uint64_t), 1, file);
+            fwrite(&section->nbins[k], sizeof(uint64_t), 1, file);
+        }
+        free(section->name);
+    }
+    fwrite(&directory, sizeof(directory), 1, file);
+    int failed = ferror(file) != 0;
+    failed |= fclose(file) != 0;
+    free(tiles->sections);
+    free(tiles);
+    return failed;
+}
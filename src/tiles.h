@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+
+/* A tiles file: "ZHTILES1", then for every sequence the bins of each level,
+   finest first, then a directory and its offset (uint64) in the last 8 bytes.
+   The directory holds the number of sections (uint32) and for each: its name
+   (uint32 length and bytes), length (uint64), shift of the finest bin size
+   (uint32), number of levels (uint32) and per level the offset and number of
+   bins (uint64 each). Bin sizes double from level to level; the last level
+   is a single bin. A bin is the minimum, maximum and mean dl, then the same
+   for the probability (floats, NaN when empty) and the number of windows
+   with data (uint32). All in native byte order. */
+
+typedef struct Tiles Tiles;
+
+Tiles* tiles_open(const char* filename);
+void tiles_begin(Tiles* tiles, const char* name, size_t length);
+void tiles_add(Tiles* tiles, double dl, double probability);
+int tiles_close(Tiles* tiles);
@@ -0,0 +1,617 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "track.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+/* Scores are written as runs of equal value (as a float) to a bedGraph and/or
+   a bigWig file. The bigWig's data blocks are appended as the runs come, zoom
+   level summaries go to a temporary file per level, and the chromosome tree,
+   the R-tree indices and the zoom levels follow when the track is closed, after
+   which the header is filled in. Everything is in native byte order, which
+   readers tell from the magic number. Index nodes are padded to BLOCK_SIZE
+   entries so that child offsets can be computed before they are written. */
+
+#define BIGWIG_MAGIC 0x888FFC26
+#define CHROM_TREE_MAGIC 0x78CA8C91
+#define RTREE_MAGIC 0x2468ACE0
+#define ITEMS_PER_SLOT 1024 /* items per data block, records per zoom block */
+#define BLOCK_SIZE 256 /* entries per index node */
+#define ZOOM_LEVELS 10
+#define ZOOM_FIRST 32 /* bases per record of the first zoom level, 4 times more each level */
+
+#define HEADER_SIZE 64
+#define ZOOM_HEADER_SIZE 24
+#define TOTAL_SUMMARY_SIZE 40
+#define ITEM_SIZE 12
+#define SECTION_HEADER_SIZE 24
+#define ZOOM_RECORD_SIZE 32
+
+typedef struct {
+    uint32_t chrom;
+    uint32_t start;
+    uint32_t end;
+    uint64_t offset;
+    uint64_t size;
+} Block;
+
+typedef struct {
+    Block* blocks;
+    size_t n;
+    size_t capacity;
+} Index;
+
+typedef struct {
+    uint32_t chrom;
+    uint32_t start;
+    uint32_t end;
+    uint64_t count;
+    double min;
+    double max;
+    double sum;
+    double squares;
+} Summary;
+
+typedef struct {
+    uint32_t reduction;
+    FILE* file;
+    uint64_t size;
+    Summary current;
+    int open;
+    unsigned char records[ITEMS_PER_SLOT * ZOOM_RECORD_SIZE];
+    int nrecords;
+    uint32_t count;
+    Block block; /* bounds of the pending records */
+    Index index;
+} Zoom;
+
+struct Track {
+    FILE* bedgraph;
+    FILE* bigwig;
+    char** chroms;
+    uint32_t* sizes;
+    uint32_t nchroms;
+    uint32_t capacity;
+    int inrun;
+    uint32_t runstart;
+    uint32_t runend;
+    float runvalue;
+    unsigned char items[SECTION_HEADER_SIZE + ITEMS_PER_SLOT * ITEM_SIZE];
+    int nitems;
+    Block block; /* bounds of the pending items */
+    Index index;
+    Zoom zooms[ZOOM_LEVELS];
+    Summary total;
+    uint32_t maxblock;
+    unsigned char* buffer;
+    size_t buffersize;
+};
+
+static unsigned char* put16(unsigned char* p, uint16_t v)
+{
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static unsigned char* put32(unsigned char* p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static unsigned char* put64(unsigned char* p, uint64_t v)
+{
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static unsigned char* putfloat(unsigned char* p, float v)
+{
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static unsigned char* putdouble(unsigned char* p, double v)
+{
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static void summary_reset(Summary* summary)
+{
+    summary->count = 0;
+    summary->min = INFINITY;
+    summary->max = -INFINITY;
+    summary->sum = summary->squares = 0.0;
+}
+
+static void summary_add(Summary* summary, uint32_t bases, double value)
+{
+    summary->count += bases;
+    summary->min = (value < summary->min) ? value : summary->min;
+    summary->max = (value > summary->max) ? value : summary->max;
+    summary->sum += value * bases;
+    summary->squares += value * value * bases;
+}
+
+static void index_add(Index* index, const Block* block)
+{
+    if (index->n == index->capacity) {
+        index->capacity = index->capacity ? 2 * index->capacity : 1024;
+        index->blocks = (Block*)realloc(index->blocks, index->capacity * sizeof(Block));
+    }
+    index->blocks[index->n++] = *block;
+}
+
+/* compresses 'size' bytes onto the end of 'file', returning the compressed size */
+static uint64_t write_block(Track* track, FILE* file, const unsigned char* data, size_t size)
+{
+    uLongf compressed = compressBound(size);
+    if (compressed > track->buffersize) {
+        track->buffersize = compressed;
+        track->buffer = (unsigned char*)realloc(track->buffer, compressed);
+    }
+    compress(track->buffer, &compressed, data, size);
+    fwrite(track->buffer, 1, compressed, file);
+    if (size > track->maxblock) {
+        track->maxblock = size;
+    }
+    return compressed;
+}
+
+Track* track_open(const char* bedgraphfile, const char* bigwigfile)
+{
+    Track* track = (Track*)calloc(1, sizeof(Track));
+    summary_reset(&track->total);
+    if (bedgraphfile != NULL) {
+        track->bedgraph = fopen(bedgraphfile, "w");
+        if (track->bedgraph == NULL) {
+            free(track);
+            return NULL;
+        }
+    }
+    if (bigwigfile != NULL) {
+        track->bigwig = fopen(bigwigfile, "wb");
+        if (track->bigwig == NULL) {
+            track_close(track);
+            return NULL;
+        }
+        /* header, zoom headers and total summary are filled in on closing,
+           the number of data blocks comes first in the data */
+        unsigned char zero[HEADER_SIZE + ZOOM_LEVELS * ZOOM_HEADER_SIZE + TOTAL_SUMMARY_SIZE + 8] = { 0 };
+        fwrite(zero, 1, sizeof(zero), track->bigwig);
+        uint32_t reduction = ZOOM_FIRST;
+        for (int z = 0; z < ZOOM_LEVELS; z++, reduction *= 4) {
+            track->zooms[z].reduction = reduction;
+            track->zooms[z].file = tmpfile();
+            if (track->zooms[z].file == NULL) {
+                track_close(track);
+                return NULL;
+            }
+        }
+    }
+    return track;
+}
+
+static void flush_items(Track* track)
+{
+    if (track->nitems == 0) {
+        return;
+    }
+    Block* block = &track->block;
+    unsigned char* p = track->items;
+    p = put32(p, block->chrom);
+    p = put32(p, block->start);
+    p = put32(p, block->end);
+    p = put32(p, 0); /* item step */
+    p = put32(p, 0); /* item span */
+    *p++ = 1; /* bedGraph items */
+    *p++ = 0;
+    put16(p, track->nitems);
+    block->offset = ftello(track->bigwig);
+    block->size = write_block(track, track->bigwig, track->items, SECTION_HEADER_SIZE + track->nitems * ITEM_SIZE);
+    index_add(&track->index, block);
+    track->nitems = 0;
+}
+
+static void flush_records(Track* track, Zoom* zoom)
+{
+    if (zoom->nrecords == 0) {
+        return;
+    }
+    zoom->block.offset = zoom->size;
+    zoom->block.size = write_block(track, zoom->file, zoom->records, zoom->nrecords * ZOOM_RECORD_SIZE);
+    zoom->size += zoom->block.size;
+    index_add(&zoom->index, &zoom->block);
+    zoom->nrecords = 0;
+}
+
+/* moves the summary being gathered to the pending records */
+static void flush_summary(Track* track, Zoom* zoom)
+{
+    if (!zoom->open) {
+        return;
+    }
+    if (zoom->nrecords == ITEMS_PER_SLOT) {
+        flush_records(track, zoom);
+    }
+    const Summary* summary = &zoom->current;
+    if (zoom->nrecords == 0) {
+        zoom->block.chrom = summary->chrom;
+        zoom->block.start = summary->start;
+    }
+    zoom->block.end = summary->end;
+    unsigned char* p = zoom->records + zoom->nrecords * ZOOM_RECORD_SIZE;
+    p = put32(p, summary->chrom);
+    p = put32(p, summary->start);
+    p = put32(p, summary->end);
+    p = put32(p, (uint32_t)summary->count);
+    p = putfloat(p, summary->min);
+    p = putfloat(p, summary->max);
+    p = putfloat(p, summary->sum);
+    putfloat(p, summary->squares);
+    zoom->nrecords++;
+    zoom->count++;
+    zoom->open = 0;
+}
+
+/* adds [start, end) to the summaries of a zoom level, which cover 'reduction'
+   bases from the first base they see */
+static void zoom_add(Track* track, Zoom* zoom, uint32_t chrom, uint32_t start, uint32_t end, float value)
+{
+    while (start < end) {
+        Summary* summary = &zoom->current;
+        if (!zoom->open || summary->end <= start) {
+            flush_summary(track, zoom);
+            summary->chrom = chrom;
+            summary->start = start;
+            summary->end = (track->sizes[chrom] - start > zoom->reduction) ? start + zoom->reduction : track->sizes[chrom];
+            summary_reset(summary);
+            zoom->open = 1;
+        }
+        uint32_t last = (end < summary->end) ? end : summary->end;
+        summary_add(summary, last - start, value);
+        start = last;
+    }
+}
+
+static void flush_run(Track* track)
+{
+    if (!track->inrun) {
+        return;
+    }
+    track->inrun = 0;
+    uint32_t chrom = track->nchroms - 1;
+    uint32_t start = track->runstart, end = track->runend;
+    float value = track->runvalue;
+    summary_add(&track->total, end - start, value);
+    if (track->bedgraph != NULL) {
+        fprintf(track->bedgraph, "%s\t%u\t%u\t%g\n", track->chroms[chrom], start, end, value);
+    }
+    if (track->bigwig == NULL) {
+        return;
+    }
+
+    if (track->nitems == ITEMS_PER_SLOT) {
+        flush_items(track);
+    }
+    if (track->nitems == 0) {
+        track->block.chrom = chrom;
+        track->block.start = start;
+    }
+    track->block.end = end;
+    unsigned char* p = track->items + SECTION_HEADER_SIZE + track->nitems * ITEM_SIZE;
+    p = put32(p, start);
+    p = put32(p, end);
+    putfloat(p, value);
+    track->nitems++;
+    for (int z = 0; z < ZOOM_LEVELS; z++) {
+        zoom_add(track, &track->zooms[z], chrom, start, end, value);
+    }
+}
+
+/* starts a new chromosome; blocks never span two */
+void track_begin(Track* track, const char* chrom, size_t length)
+{
+    flush_run(track);
+    if (track->bigwig != NULL) {
+        flush_items(track);
+        for (int z = 0; z < ZOOM_LEVELS; z++) {
+            flush_summary(track, &track->zooms[z]);
+            flush_records(track, &track->zooms[z]);
+        }
+    }
+    if (track->nchroms == track->capacity) {
+        track->capacity = track->capacity ? 2 * track->capacity : 64;
+        track->chroms = (char**)realloc(track->chroms, track->capacity * sizeof(char*));
+        track->sizes = (uint32_t*)realloc(track->sizes, track->capacity * sizeof(uint32_t));
+    }
+    track->chroms[track->nchroms] = strdup(chrom);
+    track->sizes[track->nchroms] = (uint32_t)length;
+    track->nchroms++;
+}
+
+/* the score of the window at 'position' of the current chromosome, in
+   increasing order; NaN leaves the base out */
+void track_add(Track* track, size_t position, double value)
+{
+    if (isnan(value)) {
+        flush_run(track);
+        return;
+    }
+    float v = (float)value;
+    if (track->inrun && position == track->runend && v == track->runvalue) {
+        track->runend++;
+        return;
+    }
+    flush_run(track);
+    track->inrun = 1;
+    track->runstart = (uint32_t)position;
+    track->runend = (uint32_t)position + 1;
+    track->runvalue = v;
+}
+
+static int count_levels(uint64_t block, uint64_t n)
+{
+    int levels = 1;
+    while (n > block) {
+        n = (n + block - 1) / block;
+        levels++;
+    }
+    return levels;
+}
+
+typedef struct {
+    const char* name;
+    uint32_t id;
+    uint32_t size;
+} ChromKey;
+
+static int compare_keys(const void* a, const void* b)
+{
+    return strcmp(((const ChromKey*)a)->name, ((const ChromKey*)b)->name);
+}
+
+/* the B+ tree of chromosome names, sorted, with their ids and sizes */
+static void write_chrom_tree(Track* track, FILE* file)
+{
+    uint64_t n = track->nchroms;
+    ChromKey* keys = (ChromKey*)malloc((n + 1) * sizeof(ChromKey));
+    uint32_t keysize = 1;
+    for (uint32_t i = 0; i < n; i++) {
+        keys[i] = (ChromKey) { track->chroms[i], i, track->sizes[i] };
+        keysize = (strlen(keys[i].name) > keysize) ? strlen(keys[i].name) : keysize;
+    }
+    qsort(keys, n, sizeof(ChromKey), compare_keys);
+
+    uint64_t block = (n < BLOCK_SIZE) ? (n ? n : 1) : BLOCK_SIZE;
+    unsigned char header[32];
+    unsigned char* p = put32(header, CHROM_TREE_MAGIC);
+    p = put32(p, block);
+    p = put32(p, keysize);
+    p = put32(p, 8); /* value size */
+    p = put64(p, n);
+    put64(p, 0);
+    fwrite(header, 1, sizeof(header), file);
+
+    size_t slotsize = keysize + 8, nodesize = 4 + block * slotsize;
+    unsigned char* node = (unsigned char*)malloc(nodesize);
+    uint64_t levelstart = ftello(file);
+    int levels = count_levels(block, n);
+    for (int level = levels - 1; level > 0; level--) {
+        uint64_t perslot = 1;
+        for (int l = 0; l < level; l++) {
+            perslot *= block;
+        }
+        uint64_t pernode = perslot * block, nodes = (n + pernode - 1) / pernode;
+        uint64_t child = levelstart + nodes * nodesize;
+        for (uint64_t first = 0; first < n; first += pernode) {
+            memset(node, 0, nodesize);
+            uint16_t count = 0;
+            for (uint64_t k = first; k < n && k < first + pernode; k += perslot, count++) {
+                unsigned char* slot = node + 4 + count * slotsize;
+                memcpy(slot, keys[k].name, strlen(keys[k].name));
+                put64(slot + keysize, child);
+                child += nodesize;
+            }
+            put16(node + 2, count);
+            fwrite(node, 1, nodesize, file);
+        }
+        levelstart += nodes * nodesize;
+    }
+    uint64_t first = 0;
+    do {
+        memset(node, 0, nodesize);
+        node[0] = 1; /* leaf */
+        uint16_t count = 0;
+        for (uint64_t k = first; k < n && k < first + block; k++, count++) {
+            unsigned char* slot = node + 4 + count * slotsize;
+            memcpy(slot, keys[k].name, strlen(keys[k].name));
+            put32(put32(slot + keysize, keys[k].id), keys[k].size);
+        }
+        put16(node + 2, count);
+        fwrite(node, 1, nodesize, file);
+        first += block;
+    } while (first < n);
+    free(node);
+    free(keys);
+}
+
+/* the R-tree over the blocks of an index, which are in position order */
+static void write_rtree(FILE* file, const Index* index, uint64_t dataend)
+{
+    uint64_t n = index->n;
+    const Block* blocks = index->blocks;
+    unsigned char header[48];
+    unsigned char* p = put32(header, RTREE_MAGIC);
+    p = put32(p, BLOCK_SIZE);
+    p = put64(p, n);
+    p = put32(p, n ? blocks[0].chrom : 0);
+    p = put32(p, n ? blocks[0].start : 0);
+    p = put32(p, n ? blocks[n - 1].chrom : 0);
+    p = put32(p, n ? blocks[n - 1].end : 0);
+    p = put64(p, dataend);
+    p = put32(p, ITEMS_PER_SLOT);
+    put32(p, 0);
+    fwrite(header, 1, sizeof(header), file);
+
+    size_t leafsize = 4 + BLOCK_SIZE * 32, innersize = 4 + BLOCK_SIZE * 24;
+    unsigned char* node = (unsigned char*)malloc(leafsize);
+    uint64_t levelstart = ftello(file);
+    int levels = count_levels(BLOCK_SIZE, n);
+    for (int level = levels - 1; level > 0; level--) {
+        uint64_t perslot = 1;
+        for (int l = 0; l < level; l++) {
+            perslot *= BLOCK_SIZE;
+        }
+        uint64_t pernode = perslot * BLOCK_SIZE, nodes = (n + pernode - 1) / pernode;
+        uint64_t child = levelstart + nodes * innersize;
+        for (uint64_t first = 0; first < n; first += pernode) {
+            memset(node, 0, innersize);
+            uint16_t count = 0;
+            for (uint64_t k = first; k < n && k < first + pernode; k += perslot, count++) {
+                const Block* last = &blocks[(k + perslot < n) ? k + perslot - 1 : n - 1];
+                unsigned char* q = node + 4 + count * 24;
+                q = put32(q, blocks[k].chrom);
+                q = put32(q, blocks[k].start);
+                q = put32(q, last->chrom);
+                q = put32(q, last->end);
+                put64(q, child);
+                child += (level == 1) ? leafsize : innersize;
+            }
+            put16(node + 2, count);
+            fwrite(node, 1, innersize, file);
+        }
+        levelstart += nodes * innersize;
+    }
+    uint64_t first = 0;
+    do {
+        memset(node, 0, leafsize);
+        node[0] = 1; /* leaf */
+        uint16_t count = 0;
+        for (uint64_t k = first; k < n && k < first + BLOCK_SIZE; k++, count++) {
+            unsigned char* q = node + 4 + count * 32;
+            q = put32(q, blocks[k].chrom);
+            q = put32(q, blocks[k].start);
+            q = put32(q, blocks[k].chrom);
+            q = put32(q, blocks[k].end);
+            q = put64(q, blocks[k].offset);
+            put64(q, blocks[k].size);
+        }
+        put16(node + 2, count);
+        fwrite(node, 1, leafsize, file);
+        first += BLOCK_SIZE;
+    } while (first < n);
+    free(node);
+}
+
+/* appends the indices and zoom levels and fills in the header */
+static int finish_bigwig(Track* track)
+{
+    FILE* file = track->bigwig;
+    flush_items(track);
+    uint32_t longest = 0;
+    for (uint32_t i = 0; i < track->nchroms; i++) {
+        longest = (track->sizes[i] > longest) ? track->sizes[i] : longest;
+    }
+    /* levels summarizing whole chromosomes are no use */
+    int nzooms = 0;
+    while (nzooms < ZOOM_LEVELS && track->zooms[nzooms].reduction < longest) {
+        nzooms++;
+    }
+    for (int z = 0; z < ZOOM_LEVELS; z++) {
+        flush_summary(track, &track->zooms[z]);
+        flush_records(track, &track->zooms[z]);
+    }
+
+    uint64_t fulldata = HEADER_SIZE + ZOOM_LEVELS * ZOOM_HEADER_SIZE + TOTAL_SUMMARY_SIZE;
+    uint64_t dataend = ftello(file);
+    uint64_t chromtree = dataend;
+    write_chrom_tree(track, file);
+    uint64_t fullindex = ftello(file);
+    write_rtree(file, &track->index, dataend);
+
+    uint64_t zoomdata[ZOOM_LEVELS], zoomindex[ZOOM_LEVELS];
+    char copy[1 << 16];
+    for (int z = 0; z < nzooms; z++) {
+        Zoom* zoom = &track->zooms[z];
+        zoomdata[z] = ftello(file);
+        fwrite(&zoom->count, sizeof(zoom->count), 1, file);
+        rewind(zoom->file);
+        size_t n;
+        while ((n = fread(copy, 1, sizeof(copy), zoom->file)) > 0) {
+            fwrite(copy, 1, n, file);
+        }
+        for (size_t b = 0; b < zoom->index.n; b++) {
+            zoom->index.blocks[b].offset += zoomdata[z] + sizeof(zoom->count);
+        }
+        zoomindex[z] = ftello(file);
+        write_rtree(file, &zoom->index, zoomindex[z]);
+    }
+    uint32_t magic = BIGWIG_MAGIC;
+    fwrite(&magic, sizeof(magic), 1, file);
+
+    unsigned char header[HEADER_SIZE + ZOOM_LEVELS * ZOOM_HEADER_SIZE + TOTAL_SUMMARY_SIZE + 8] = { 0 };
+    unsigned char* p = put32(header, BIGWIG_MAGIC);
+    p = put16(p, 4); /* version */
+    p = put16(p, nzooms);
+    p = put64(p, chromtree);
+    p = put64(p, fulldata);
+    p = put64(p, fullindex);
+    p = put16(p, 0); /* field count */
+    p = put16(p, 0); /* defined field count */
+    p = put64(p, 0); /* autoSql offset */
+    p = put64(p, HEADER_SIZE + ZOOM_LEVELS * ZOOM_HEADER_SIZE);
+    p = put32(p, track->maxblock);
+    p = put64(p, 0); /* extension offset */
+    for (int z = 0; z < ZOOM_LEVELS; z++) {
+        p = put32(p, (z < nzooms) ? track->zooms[z].reduction : 0);
+        p = put32(p, 0);
+        p = put64(p, (z < nzooms) ? zoomdata[z] : 0);
+        p = put64(p, (z < nzooms) ? zoomindex[z] : 0);
+    }
+    const Summary* total = &track->total;
+    p = put64(p, total->count);
+    p = putdouble(p, total->count ? total->min : 0.0);
+    p = putdouble(p, total->count ? total->max : 0.0);
+    p = putdouble(p, total->sum);
+    p = putdouble(p, total->squares);
+    put64(p, track->index.n); /* data blocks */
+    fseeko(file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), file);
+    return ferror(file);
+}
+
+/* finishes the files; returns nonzero if one couldn't be written */
+int track_close(Track* track)
+{
+    flush_run(track);
+    int failed = 0;
+    if (track->bedgraph != NULL) {
+        failed |= fclose(track->bedgraph) != 0;
+    }
+    if (track->bigwig != NULL) {
+        failed |= finish_bigwig(track) != 0;
+        failed |= fclose(track->bigwig) != 0;
+        for (int z = 0; z < ZOOM_LEVELS; z++) {
+            if (track->zooms[z].file != NULL) {
+                fclose(track->zooms[z].file);
+            }
+            free(track->zooms[z].index.blocks);
+        }
+    }
+    for (uint32_t i = 0; i < track->nchroms; i++) {
+        free(track->chroms[i]);
+    }
+    free(track->chroms);
+    free(track->sizes);
+    free(track->index.blocks);
+    free(track->buffer);
+    free(track);
+    return failed;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef struct Track Track;
+
+Track* track_open(const char* bedgraphfile, const char* bigwigfile);
+void track_begin(Track* track, const char* chrom, size_t length);
+void track_add(Track* track, size_t position, double value);
+int track_close(Track* track);
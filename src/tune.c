@@ -0,0 +1,150 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "tune.h"
+
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define TUNE_LINE 1024
+
+/* the CPU model as /proc/cpuinfo names it on x86, ARM or POWER, and the
+   processors this run may use */
+void tune_host(char* host, size_t size, int* cores)
+{
+    static const char* keys[] = { "model name", "Model", "Hardware", "cpu" };
+    snprintf(host, size, "unknown");
+    FILE* file = fopen("/proc/cpuinfo", "r");
+    char line[TUNE_LINE];
+    int found = sizeof(keys) / sizeof(keys[0]); /* rank of the key found so far */
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        char* colon = strchr(line, ':');
+        if (colon == NULL) {
+            continue;
+        }
+        size_t keylength = strcspn(line, "\t:");
+        for (int k = 0; k < found; k++) {
+            if (strlen(keys[k]) == keylength && strncmp(line, keys[k], keylength) == 0) {
+                char* value = colon + 1 + strspn(colon + 1, " \t");
+                value[strcspn(value, "\n")] = '\0';
+                snprintf(host, size, "%s", value);
+                found = k;
+                break;
+            }
+        }
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    for (char* c = host; *c != '\0'; c++) {
+        *c = (*c == '\t') ? ' ' : *c; /* the cache separates fields by tabs */
+    }
+    *cores = omp_get_num_procs();
+}
+
+/* NULL if there is to be no cache */
+const char* tune_cachefile(void)
+{
+    static char path[4096];
+    const char* name = getenv("ZHUNT_TUNE");
+    if (name != NULL) {
+        return (name[0] != '\0') ? name : NULL;
+    }
+    const char* cache = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (cache != NULL && cache[0] != '\0') {
+        snprintf(path, sizeof(path), "%s/zhunt.tune", cache);
+    } else if (home != NULL && home[0] != '\0') {
+        snprintf(path, sizeof(path), "%s/.cache/zhunt.tune", home);
+    } else {
+        return NULL;
+    }
+    return path;
+}
+
+#define TUNE_FIELDS 8 /* after the CPU model: cores, window sizes from and to, then the Tuning */
+
+/* the fields of the cache line after the CPU model if it is this host's, the
+   number read, 0 if it is another host's */
+static int host_fields(const char* line, const char* host, int cores, int* fields)
+{
+    const char* tab = strchr(line, '\t');
+    if (line[0] == '#' || tab == NULL || (size_t)(tab - line) != strlen(host) || strncmp(line, host, tab - line) != 0) {
+        return 0;
+    }
+    int n = sscanf(tab + 1, "%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d", &fields[0], &fields[1], &fields[2], &fields[3], &fields[4], &fields[5],
+        &fields[6], &fields[7]);
+    return (n >= 1 && fields[0] == cores) ? n : 0;
+}
+
+/* 0 if the cache has a valid tuning for this host and these window sizes */
+int tune_load(int fromdin, int todin, Tuning* tuning)
+{
+    const char* filename = tune_cachefile();
+    FILE* file = (filename != NULL) ? fopen(filename, "r") : NULL;
+    if (file == NULL) {
+        return -1;
+    }
+    char host[256], line[TUNE_LINE];
+    int cores, found = 0, fields[TUNE_FIELDS];
+    tune_host(host, sizeof(host), &cores);
+    while (!found && fgets(line, sizeof(line), file) != NULL) {
+        found = host_fields(line, host, cores, fields) == TUNE_FIELDS && fields[1] == fromdin && fields[2] == todin;
+    }
+    fclose(file);
+    if (found) {
+        *tuning = (Tuning) { fields[3], fields[4], fields[5], fields[6], fields[7] };
+    }
+    if (!found || tuning->threads < 1 || tuning->chunk < 1 || (tuning->lanes != 0 && tuning->lanes != 1)
+        || (tuning->incremental != 0 && tuning->incremental != 1) || (tuning->specialized != 0 && tuning->specialized != 1)) {
+        return -1;
+    }
+    return 0;
+}
+
+/* replaces this host's line of the cache for these window sizes, keeping the
+   others but those of this host in an older format, atomically */
+int tune_save(int fromdin, int todin, const Tuning* tuning)
+{
+    const char* filename = tune_cachefile();
+    if (filename == NULL) {
+        return -1;
+    }
+    if (getenv("ZHUNT_TUNE") == NULL) {
+        char directory[4096];
+        snprintf(directory, sizeof(directory), "%s", filename);
+        *strrchr(directory, '/') = '\0';
+        mkdir(directory, 0755); /* ~/.cache may not exist yet */
+    }
+    char host[256], line[TUNE_LINE];
+    int cores, fields[TUNE_FIELDS];
+    tune_host(host, sizeof(host), &cores);
+
+    char* temporary = (char*)malloc(strlen(filename) + 5);
+    sprintf(temporary, "%s.tmp", filename);
+    FILE* out = fopen(temporary, "w");
+    if (out == NULL) {
+        free(temporary);
+        return -1;
+    }
+    FILE* in = fopen(filename, "r");
+    if (in == NULL) {
+        fprintf(out, "# zhunt --tune: cpu model, cores, window sizes from, to, threads, chunk, lanes, incremental, specialized\n");
+    }
+    while (in != NULL && fgets(line, sizeof(line), in) != NULL) {
+        int n = host_fields(line, host, cores, fields);
+        if (n == 0 || (n == TUNE_FIELDS && (fields[1] != fromdin || fields[2] != todin))) {
+            fputs(line, out);
+        }
+    }
+    if (in != NULL) {
+        fclose(in);
+    }
+    fprintf(out, "%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n", host, cores, fromdin, todin, tuning->threads, tuning->chunk, tuning->lanes,
+        tuning->incremental, tuning->specialized);
+    int failed = fclose(out) != 0 || rename(temporary, filename) != 0;
+    free(temporary);
+    return failed ? -1 : 0;
+}
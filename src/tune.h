@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+
+/* What zhunt --tune found fastest on a host for a range of window sizes. It is
+   cached under the host's CPU model and core count and the range, in the file
+   named by $ZHUNT_TUNE (no cache if empty), or else $XDG_CACHE_HOME/zhunt.tune
+   or ~/.cache/zhunt.tune, one line each, and applied to every later run there
+   scoring the same range. */
+typedef struct {
+    int threads;
+    int chunk; /* positions a thread takes at a time */
+    int lanes; /* conformations searched ANTISYN_LANES windows at a time */
+    int incremental; /* coefficients updated from window to window by the lanes */
+    int specialized; /* kernels of their own for the sizes in specialize.h */
+} Tuning;
+
+void tune_host(char* host, size_t size, int* cores);
+const char* tune_cachefile(void);
+int tune_load(int fromdin, int todin, Tuning* tuning);
+int tune_save(int fromdin, int todin, const Tuning* tuning);
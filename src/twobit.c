@@ -0,0 +1,171 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "twobit.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* UCSC .2bit files: a header and an index of sequence names and offsets, then
+   per sequence its length, the blocks of N, the soft-masked blocks and the
+   bases packed four to a byte (T=0, C=1, A=2, G=3, first base in the high bits).
+   The file is mmapped and the packed bases are used in place. */
+
+#define TWOBIT_SIGNATURE 0x1A412743u
+
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+    int swap;
+    int error;
+} Cursor;
+
+static uint32_t read_u32(Cursor* c)
+{
+    if (c->pos + 4 > c->size) {
+        c->error = 1;
+        return 0;
+    }
+    const uint8_t* p = c->data + c->pos;
+    c->pos += 4;
+    if (c->swap) {
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read_u64(Cursor* c)
+{
+    uint64_t lo = read_u32(c);
+    uint64_t hi = read_u32(c);
+    return c->swap ? (lo << 32) | hi : (hi << 32) | lo;
+}
+
+static size_t* read_blocks(Cursor* c, size_t count)
+{
+    if (count > (c->size - c->pos) / 4) {
+        c->error = 1;
+        return NULL;
+    }
+    size_t* blocks = (size_t*)malloc((count + 1) * sizeof(size_t));
+    for (size_t i = 0; i < count; i++) {
+        blocks[i] = read_u32(c);
+    }
+    return blocks;
+}
+
+static int signature_swap(const uint8_t* p, int* swap)
+{
+    uint32_t le = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    uint32_t be = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    *swap = (be == TWOBIT_SIGNATURE);
+    return le == TWOBIT_SIGNATURE || be == TWOBIT_SIGNATURE;
+}
+
+int twobit_detect(const char* filename)
+{
+    uint8_t magic[4];
+    int swap;
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    size_t n = fread(magic, 1, 4, file);
+    fclose(file);
+    return n == 4 && signature_swap(magic, &swap);
+}
+
+static void free_records(TwoBitRecord* records, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        free(records[i].name);
+        free(records[i].nstarts);
+        free(records[i].nsizes);
+        free(records[i].maskstarts);
+        free(records[i].masksizes);
+    }
+    free(records);
+}
+
+TwoBit* twobit_open(const char* filename)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < 16) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    Cursor c = { (const uint8_t*)data, st.st_size, 0, 0, 0 };
+    if (!signature_swap(c.data, &c.swap)) {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+    c.pos = 4;
+    uint32_t version = read_u32(&c);
+    size_t count = read_u32(&c);
+    read_u32(&c); /* reserved */
+    if (version > 1 || count > c.size / 5) {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+
+    TwoBitRecord* records = (TwoBitRecord*)calloc(count, sizeof(TwoBitRecord));
+    for (size_t i = 0; i < count && !c.error; i++) {
+        size_t namesize = (c.pos < c.size) ? c.data[c.pos++] : 0;
+        if (namesize == 0 || c.pos + namesize > c.size) {
+            c.error = 1;
+            break;
+        }
+        records[i].name = strndup((const char*)c.data + c.pos, namesize);
+        c.pos += namesize;
+        size_t offset = (version == 1) ? read_u64(&c) : read_u32(&c);
+
+        Cursor r = { c.data, c.size, offset, c.swap, 0 };
+        records[i].length = read_u32(&r);
+        records[i].nblocks = read_u32(&r);
+        records[i].nstarts = read_blocks(&r, records[i].nblocks);
+        records[i].nsizes = read_blocks(&r, records[i].nblocks);
+        records[i].maskblocks = read_u32(&r);
+        records[i].maskstarts = read_blocks(&r, records[i].maskblocks);
+        records[i].masksizes = read_blocks(&r, records[i].maskblocks);
+        read_u32(&r); /* reserved */
+        records[i].packed = r.data + r.pos;
+        if (r.error || (r.size - r.pos) < (records[i].length + 3) / 4) {
+            c.error = 1;
+        }
+    }
+    if (c.error) {
+        fprintf(stderr, "twobit: %s is truncated or malformed\n", filename);
+        free_records(records, count);
+        munmap(data, st.st_size);
+        return NULL;
+    }
+    posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    TwoBit* twobit = (TwoBit*)malloc(sizeof(TwoBit));
+    twobit->data = (const uint8_t*)data;
+    twobit->size = st.st_size;
+    twobit->records = records;
+    twobit->count = count;
+    return twobit;
+}
+
+void twobit_close(TwoBit* twobit)
+{
+    free_records(twobit->records, twobit->count);
+    munmap((void*)twobit->data, twobit->size);
+    free(twobit);
+}
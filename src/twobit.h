@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    char* name;
+    size_t length;
+    const uint8_t* packed;
+    size_t nblocks;
+    size_t* nstarts;
+    size_t* nsizes;
+    size_t maskblocks;
+    size_t* maskstarts;
+    size_t* masksizes;
+} TwoBitRecord;
+
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    TwoBitRecord* records;
+    size_t count;
+} TwoBit;
+
+int twobit_detect(const char* filename);
+TwoBit* twobit_open(const char* filename);
+void twobit_close(TwoBit* twobit);
@@ -0,0 +1,497 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "variants.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+/* The VCF (plain or gzip) is read in order. Each haplotype (two per diploid
+   sample, in GT order) keeps an open cluster of the alternate alleles it
+   carries; a variant at least span - 1 bases past its end can't share a
+   window with it, so reaching one closes the cluster, which is then looked up
+   by key among the pending ones and added to or listed as new. A pending
+   cluster ending span - 1 bases before the variant just read can't get any
+   more carriers, so it is finished, and handed out, in batches, once no
+   cluster still pending or open can start before it, which keeps the order
+   by start across batches. Without samples every alternate allele is a
+   cluster of its own. */
+
+#define VCF_BATCH 4096 /* finished clusters handed out at once */
+
+typedef struct {
+    size_t pos;
+    char* ref;
+    char** alts;
+    int nalts;
+} Variant;
+
+typedef struct {
+    uint32_t* variants;
+    uint8_t* alleles;
+    int n;
+    int capacity;
+    size_t end;
+} Open;
+
+struct VcfReader {
+    gzFile file;
+    char* line;
+    size_t linecapacity;
+    int held; /* 'line' is the next record, not yet used */
+    size_t span;
+    char** samples;
+    int nsamples;
+    char* chrom; /* of the variants being read */
+    Variant* variants;
+    size_t nvariants;
+    size_t capacity;
+    Open* open; /* per haplotype */
+    Cluster** table; /* pending clusters by hash, open addressing */
+    size_t tablesize;
+    size_t pending;
+    size_t sweep; /* pending clusters that trigger looking for finished ones */
+    Cluster** done;
+    size_t ndone;
+    size_t donecapacity;
+    char* key;
+    size_t keycapacity;
+};
+
+static int read_line(VcfReader* reader)
+{
+    size_t n = 0;
+    for (;;) {
+        if (reader->linecapacity - n < 2) {
+            reader->linecapacity = (reader->linecapacity != 0) ? 2 * reader->linecapacity : 1 << 16;
+            reader->line = (char*)realloc(reader->line, reader->linecapacity);
+        }
+        if (gzgets(reader->file, reader->line + n, (int)(reader->linecapacity - n)) == NULL) {
+            reader->line[n] = '\0';
+            return n > 0;
+        }
+        n += strlen(reader->line + n);
+        if (n > 0 && reader->line[n - 1] == '\n') {
+            reader->line[--n] = '\0';
+            if (n > 0 && reader->line[n - 1] == '\r') {
+                reader->line[--n] = '\0';
+            }
+            return 1;
+        }
+    }
+}
+
+/* the tab separated field at *text, which is moved to the next one */
+static char* next_field(char** text)
+{
+    char* field = *text;
+    if (field == NULL) {
+        return NULL;
+    }
+    char* tab = strchr(field, '\t');
+    if (tab != NULL) {
+        *tab = '\0';
+        *text = tab + 1;
+    } else {
+        *text = NULL;
+    }
+    return field;
+}
+
+VcfReader* vcf_open(const char* filename, size_t span)
+{
+    gzFile file = gzopen(filename, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    VcfReader* reader = (VcfReader*)calloc(1, sizeof(VcfReader));
+    reader->file = file;
+    reader->span = span;
+    reader->sweep = VCF_BATCH;
+    while (read_line(reader)) {
+        if (strncmp(reader->line, "##", 2) == 0) {
+            continue;
+        }
+        if (strncmp(reader->line, "#CHROM", 6) != 0) {
+            reader->held = 1;
+            break;
+        }
+        char* text = reader->line;
+        for (int column = 0; next_field(&text) != NULL; column++) {
+            if (column == 8) { /* FORMAT, the samples follow */
+                char* name;
+                while ((name = next_field(&text)) != NULL) {
+                    reader->samples = (char**)realloc(reader->samples, (reader->nsamples + 1) * sizeof(char*));
+                    reader->samples[reader->nsamples++] = strdup(name);
+                }
+            }
+        }
+    }
+    reader->open = (Open*)calloc(2 * reader->nsamples + 1, sizeof(Open));
+    return reader;
+}
+
+static uint64_t hash_key(const char* key)
+{
+    uint64_t hash = 14695981039346656037ULL; /* FNV-1a */
+    for (; *key != '\0'; key++) {
+        hash = (hash ^ (unsigned char)*key) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void table_insert(VcfReader* reader, Cluster* cluster)
+{
+    if (2 * (reader->pending + 1) > reader->tablesize) {
+        Cluster** old = reader->table;
+        size_t oldsize = reader->tablesize;
+        reader->tablesize = (oldsize != 0) ? 2 * oldsize : 1024;
+        reader->table = (Cluster**)calloc(reader->tablesize, sizeof(Cluster*));
+        reader->pending = 0;
+        for (size_t i = 0; i < oldsize; i++) {
+            if (old[i] != NULL) {
+                table_insert(reader, old[i]);
+            }
+        }
+        free(old);
+    }
+    size_t i = cluster->hash & (reader->tablesize - 1);
+    while (reader->table[i] != NULL) {
+        i = (i + 1) & (reader->tablesize - 1);
+    }
+    reader->table[i] = cluster;
+    reader->pending++;
+}
+
+static Cluster* table_find(const VcfReader* reader, const char* key, uint64_t hash)
+{
+    if (reader->tablesize == 0) {
+        return NULL;
+    }
+    for (size_t i = hash & (reader->tablesize - 1); reader->table[i] != NULL; i = (i + 1) & (reader->tablesize - 1)) {
+        if (reader->table[i]->hash == hash && strcmp(reader->table[i]->key, key) == 0) {
+            return reader->table[i];
+        }
+    }
+    return NULL;
+}
+
+static void append_key(VcfReader* reader, size_t* length, const Variant* variant, int allele)
+{
+    size_t needed = *length + strlen(variant->ref) + strlen(variant->alts[allele - 1]) + 32;
+    if (reader->keycapacity < needed) {
+        reader->keycapacity = 2 * needed;
+        reader->key = (char*)realloc(reader->key, reader->keycapacity);
+    }
+    *length += sprintf(reader->key + *length, "%s%zu:%s>%s", (*length > 0) ? ";" : "", variant->pos + 1, variant->ref,
+        variant->alts[allele - 1]);
+}
+
+/* adds a carrier (NULL for none) of the changes to the cluster with their key */
+static void add_cluster(VcfReader* reader, const uint32_t* variants, const uint8_t* alleles, int n, const char* carrier)
+{
+    size_t length = 0;
+    for (int i = 0; i < n; i++) {
+        append_key(reader, &length, &reader->variants[variants[i]], alleles[i]);
+    }
+    uint64_t hash = hash_key(reader->key);
+    Cluster* cluster = table_find(reader, reader->key, hash);
+    if (cluster == NULL) {
+        cluster = (Cluster*)calloc(1, sizeof(Cluster));
+        cluster->key = strdup(reader->key);
+        cluster->hash = hash;
+        cluster->changes = (Change*)malloc(n * sizeof(Change));
+        cluster->nchanges = n;
+        for (int i = 0; i < n; i++) {
+            const Variant* variant = &reader->variants[variants[i]];
+            cluster->changes[i] = (Change) { variant->pos, strlen(variant->ref), strdup(variant->alts[alleles[i] - 1]) };
+        }
+        cluster->start = cluster->changes[0].pos;
+        cluster->end = cluster->changes[n - 1].pos + cluster->changes[n - 1].reflength;
+        table_insert(reader, cluster);
+    }
+    if (carrier != NULL) {
+        size_t needed = cluster->carrierslength + strlen(carrier) + 2;
+        if (cluster->carrierscapacity < needed) {
+            cluster->carrierscapacity = 2 * needed;
+            cluster->carriers = (char*)realloc(cluster->carriers, cluster->carrierscapacity);
+        }
+        cluster->carrierslength += sprintf(cluster->carriers + cluster->carrierslength, "%s%s",
+            (cluster->ncarriers > 0) ? "," : "", carrier);
+        cluster->ncarriers++;
+    }
+}
+
+static void close_open(VcfReader* reader, int h)
+{
+    Open* open = &reader->open[h];
+    if (open->n == 0) {
+        return;
+    }
+    char carrier[strlen(reader->samples[h / 2]) + 16];
+    sprintf(carrier, "%s:%d", reader->samples[h / 2], h % 2 + 1);
+    add_cluster(reader, open->variants, open->alleles, open->n, carrier);
+    open->n = 0;
+}
+
+/* closes the haplotypes' clusters ending span - 1 bases or more before 'pos' */
+static void close_before(VcfReader* reader, size_t pos)
+{
+    for (int h = 0; h < 2 * reader->nsamples; h++) {
+        if (reader->open[h].n > 0 && pos >= reader->open[h].end + reader->span - 1) {
+            close_open(reader, h);
+        }
+    }
+}
+
+/* whether the cluster can't get more carriers before 'pos' */
+static int finished(const VcfReader* reader, const Cluster* cluster, size_t pos)
+{
+    return pos >= cluster->end + reader->span - 1;
+}
+
+/* moves the pending clusters that can't get more carriers before 'pos' and
+   start before any that still can to 'done' */
+static void finish_before(VcfReader* reader, size_t pos)
+{
+    size_t first = pos; /* no later variant starts before it */
+    for (int h = 0; h < 2 * reader->nsamples; h++) {
+        const Open* open = &reader->open[h];
+        if (open->n > 0 && reader->variants[open->variants[0]].pos < first) {
+            first = reader->variants[open->variants[0]].pos;
+        }
+    }
+    for (size_t i = 0; i < reader->tablesize; i++) {
+        const Cluster* cluster = reader->table[i];
+        if (cluster != NULL && !finished(reader, cluster, pos) && cluster->start < first) {
+            first = cluster->start;
+        }
+    }
+
+    Cluster** table = reader->table;
+    size_t tablesize = reader->tablesize;
+    reader->table = NULL;
+    reader->tablesize = 0;
+    reader->pending = 0;
+    for (size_t i = 0; i < tablesize; i++) {
+        Cluster* cluster = table[i];
+        if (cluster == NULL) {
+            continue;
+        }
+        if (finished(reader, cluster, pos) && cluster->start < first) {
+            if (reader->ndone == reader->donecapacity) {
+                reader->donecapacity = (reader->donecapacity != 0) ? 2 * reader->donecapacity : VCF_BATCH;
+                reader->done = (Cluster**)realloc(reader->done, reader->donecapacity * sizeof(Cluster*));
+            }
+            reader->done[reader->ndone++] = cluster;
+        } else {
+            table_insert(reader, cluster);
+        }
+    }
+    free(table);
+    reader->sweep = (2 * reader->pending > VCF_BATCH) ? 2 * reader->pending : VCF_BATCH;
+}
+
+static void free_cluster(Cluster* cluster)
+{
+    for (int c = 0; c < cluster->nchanges; c++) {
+        free(cluster->changes[c].alt);
+    }
+    free(cluster->changes);
+    free(cluster->carriers);
+    free(cluster->key);
+    free(cluster);
+}
+
+static int compare_clusters(const void* a, const void* b)
+{
+    const Cluster* x = *(const Cluster* const*)a;
+    const Cluster* y = *(const Cluster* const*)b;
+    if (x->start != y->start) {
+        return (x->start < y->start) ? -1 : 1;
+    }
+    return strcmp(x->key, y->key);
+}
+
+static void free_variants(VcfReader* reader)
+{
+    for (size_t v = 0; v < reader->nvariants; v++) {
+        free(reader->variants[v].ref);
+        free(reader->variants[v].alts[0]);
+        free(reader->variants[v].alts);
+    }
+    reader->nvariants = 0;
+}
+
+static int plain_bases(const char* allele)
+{
+    return allele[0] != '\0' && strspn(allele, "ACGTNacgtn") == strlen(allele);
+}
+
+/* reads the variant in 'line', 0 if it isn't one */
+static int add_variant(VcfReader* reader, char* line)
+{
+    char* text = line;
+    next_field(&text); /* CHROM */
+    char* pos = next_field(&text);
+    next_field(&text); /* ID */
+    char* ref = next_field(&text);
+    char* alt = next_field(&text);
+    if (alt == NULL || atol(pos) < 1 || !plain_bases(ref)) {
+        return 0;
+    }
+    for (int column = 5; column < 9; column++) { /* QUAL FILTER INFO FORMAT */
+        next_field(&text);
+    }
+
+    if (reader->nvariants == reader->capacity) {
+        reader->capacity = (reader->capacity != 0) ? 2 * reader->capacity : 1024;
+        reader->variants = (Variant*)realloc(reader->variants, reader->capacity * sizeof(Variant));
+    }
+    uint32_t v = (uint32_t)reader->nvariants++;
+    Variant* variant = &reader->variants[v];
+    variant->pos = (size_t)atol(pos) - 1;
+    variant->ref = strdup(ref);
+    variant->nalts = 1;
+    for (const char* c = alt; *c != '\0'; c++) {
+        variant->nalts += (*c == ',');
+    }
+    variant->alts = (char**)malloc(variant->nalts * sizeof(char*));
+    variant->alts[0] = strdup(alt);
+    for (int k = 1; k < variant->nalts; k++) {
+        variant->alts[k] = strchr(variant->alts[k - 1], ',');
+        *variant->alts[k]++ = '\0';
+    }
+
+    close_before(reader, variant->pos);
+    if (reader->pending >= reader->sweep) {
+        finish_before(reader, variant->pos);
+    }
+
+    uint8_t allele;
+    if (reader->nsamples == 0) {
+        for (int k = 1; k <= variant->nalts; k++) {
+            allele = (uint8_t)k;
+            if (plain_bases(variant->alts[k - 1])) {
+                add_cluster(reader, &v, &allele, 1, NULL);
+            }
+        }
+        return 1;
+    }
+    /* GT comes first in a sample's field: alleles separated by / or | */
+    for (int s = 0; s < reader->nsamples; s++) {
+        char* gt = next_field(&text);
+        if (gt == NULL) {
+            break;
+        }
+        for (int j = 0; j < 2 && *gt != '\0' && *gt != ':'; j++) {
+            char* end;
+            long k = strtol(gt, &end, 10);
+            if (end == gt) { /* missing */
+                end++;
+            } else if (k >= 1 && k <= variant->nalts && k < 256 && plain_bases(variant->alts[k - 1])) {
+                Open* open = &reader->open[2 * s + j];
+                if (open->n == 0 || variant->pos >= open->end) { /* overlapping alleles keep the first */
+                    if (open->n == open->capacity) {
+                        open->capacity = (open->capacity != 0) ? 2 * open->capacity : 8;
+                        open->variants = (uint32_t*)realloc(open->variants, open->capacity * sizeof(uint32_t));
+                        open->alleles = (uint8_t*)realloc(open->alleles, open->capacity);
+                    }
+                    open->variants[open->n] = v;
+                    open->alleles[open->n++] = (uint8_t)k;
+                    open->end = variant->pos + strlen(variant->ref);
+                }
+            }
+            gt = end;
+            if (*gt == '/' || *gt == '|') {
+                gt++;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Hands out the next batch of finished clusters, all of sequence *chrom,
+   ordered by start (then key) within and across the batches of a sequence;
+   they are valid until the next call. Returns 0 at the end. */
+int vcf_next(VcfReader* reader, const char** chrom, Cluster*** clusters, size_t* count)
+{
+    for (size_t i = 0; i < reader->ndone; i++) {
+        free_cluster(reader->done[i]);
+    }
+    reader->ndone = 0;
+
+    for (;;) {
+        int more = reader->held || read_line(reader);
+        reader->held = 0;
+        if (!more) {
+            for (int h = 0; h < 2 * reader->nsamples; h++) {
+                close_open(reader, h);
+            }
+            finish_before(reader, (size_t)-1);
+            break;
+        }
+        char* line = reader->line;
+        if (line[0] == '#' || line[0] == '\0') {
+            continue;
+        }
+        size_t length = strcspn(line, "\t");
+        if (reader->chrom == NULL || strlen(reader->chrom) != length || strncmp(reader->chrom, line, length) != 0) {
+            /* the previous sequence is over */
+            for (int h = 0; h < 2 * reader->nsamples; h++) {
+                close_open(reader, h);
+            }
+            finish_before(reader, (size_t)-1);
+            if (reader->ndone > 0) {
+                reader->held = 1;
+                break;
+            }
+            free_variants(reader);
+            free(reader->chrom);
+            reader->chrom = strndup(line, length);
+        }
+        if (!add_variant(reader, line)) {
+            fprintf(stderr, "vcf: skipping malformed record at %s\n", reader->chrom);
+        }
+        if (reader->ndone >= VCF_BATCH) {
+            break;
+        }
+    }
+
+    qsort(reader->done, reader->ndone, sizeof(Cluster*), compare_clusters);
+    *chrom = reader->chrom;
+    *clusters = reader->done;
+    *count = reader->ndone;
+    return reader->ndone > 0;
+}
+
+void vcf_close(VcfReader* reader)
+{
+    for (size_t i = 0; i < reader->tablesize; i++) {
+        if (reader->table[i] != NULL) {
+            free_cluster(reader->table[i]);
+        }
+    }
+    for (size_t i = 0; i < reader->ndone; i++) {
+        free_cluster(reader->done[i]);
+    }
+    free_variants(reader);
+    for (int h = 0; h < 2 * reader->nsamples + 1; h++) {
+        free(reader->open[h].variants);
+        free(reader->open[h].alleles);
+    }
+    for (int s = 0; s < reader->nsamples; s++) {
+        free(reader->samples[s]);
+    }
+    gzclose(reader->file);
+    free(reader->open);
+    free(reader->samples);
+    free(reader->table);
+    free(reader->done);
+    free(reader->variants);
+    free(reader->chrom);
+    free(reader->line);
+    free(reader->key);
+    free(reader);
+}
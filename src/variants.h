@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A run of alternate alleles that one haplotype carries close enough together
+   for a window to see more than one, in reference coordinates. Identical
+   clusters of different haplotypes are merged, listing their carriers. */
+typedef struct {
+    size_t pos; /* 0-based */
+    size_t reflength;
+    char* alt;
+} Change;
+
+typedef struct Cluster {
+    char* key; /* pos:ref>alt;... (1-based), which identifies it */
+    uint64_t hash;
+    size_t start; /* [start, end) of the reference it replaces */
+    size_t end;
+    Change* changes;
+    int nchanges;
+    char* carriers; /* sample:haplotype,... or "-" in a VCF without samples */
+    size_t carrierslength;
+    size_t carrierscapacity;
+    size_t ncarriers;
+    double refdl; /* filled in by the caller */
+    double altdl;
+} Cluster;
+
+typedef struct VcfReader VcfReader;
+
+VcfReader* vcf_open(const char* filename, size_t span);
+int vcf_next(VcfReader* reader, const char** chrom, Cluster*** clusters, size_t* count);
+void vcf_close(VcfReader* reader);
@@ -22,48 +22,75 @@ The EMBO Journal, Vol.5, No.10, pp2737-2744, 1986
 With 0.22 kcal/mol/dinuc for mCG (Zacharias et al, Biochemistry, 1988, 2970)
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "antisyn.h"
 #include "delta_linking.h"
+#include "dlmatrix.h"
+#include "instrument.h"
+#include "progress.h"
+#include "records.h"
+#include "regions.h"
+#include "seqfile.h"
+#include "sequence.h"
+#include "tiles.h"
+#include "track.h"
+#include "tune.h"
+#include "twobit.h"
+#include "variants.h"
+#include "zscore.h"
 
-#define _POSIX_C_SOURCE 200809L
-
+#include <getopt.h>
 #include <math.h>
+#include <omp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
-/* creates a temporary file and mmaps the sequence into it */
-#ifdef USE_MMAP
-#include <fcntl.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#endif
-
+/* the outputs of a run and how far they are known to be complete */
 typedef struct {
-    double dl;
-    double slope;
-    double probability;
-    char* antisyn;
-} Result;
-
-char *tempstr, *sequence;
-#ifdef USE_MMAP
-int sequencefile;
-#endif
+    FILE* zfile;
+    FILE* pfile;
+    char* checkpointfile;
+    Checkpoint checkpoint;
+    Progress progress;
+    DlMatrix* matrix; /* written alongside, or NULL */
+    Track* track; /* bedGraph/bigWig of the scores, or NULL */
+    Tiles* tiles; /* summary pyramid of the scores, or NULL */
+    const char* failed; /* what stopped the run short, or NULL */
+} Output;
 
-static double assign_probability(double dl);
+/* Positions are scored SCORE_BLOCK at a time, then written in order, so memory
+   does not grow with the sequence; threads take score_chunk positions at a
+   time, SCORE_CHUNK unless --tune found better. */
+#define SCORE_BLOCK (1 << 20)
+#define SCORE_CHUNK 4096
+static size_t score_chunk = SCORE_CHUNK;
 
-static void analyze_zscore(char* filename);
-static void calculate_zscore(double a, int maxdinucleotides, int min, int max, char* filename);
+static int calculate_zscore(const double* a, int na, int maxdinucleotides, int min, int max, char* filename, int showprobability, int resume, const char* statusfile, const char* matrixfile, DlMatrix* query, const char* bedgraphfile, const char* bigwigfile, const char* tilesfile);
+static void calculate_regions(const double* a, int na, int maxdinucleotides, int min, int max, char* filename, const char* bedfilename, const char* faifilename, int showprobability, int resume, const char* statusfile);
+static void calculate_stream(const double* a, int na, int maxdinucleotides, int min, int max, FILE* zfile, const char* statusfile, const char* bedgraphfile, const char* bigwigfile, const char* tilesfile);
+static void calculate_variants(double a, int maxdinucleotides, int min, int max, char* filename, const char* vcffilename, const char* faifilename);
+static void calculate_scan(double a, int maxdinucleotides, int min, int max, char* filename, const char* statusfile);
+static void calculate_tune(int maxdinucleotides, int min, int max);
+static void tune_search(const Tuning* tuning);
+static void open_tracks(Output* output, const char* bedgraphfile, const char* bigwigfile, const char* tilesfile);
+static int open_output(Output* output, const char* filename, int resume);
+static void checkpoint_output(Output* output, size_t record, size_t position);
+static void close_output(Output* output);
+static void no_result(Result* result);
+static void write_result(FILE* file, const Result* results, int n);
+static void show_probability(FILE* file, size_t i, const Sequence* seq, size_t start, const Result* result);
+static void write_sweep(FILE* file, const double* a, int na);
 
 static FILE* open_file(int mode, const char* filename, const char* typestr);
-static unsigned input_sequence(FILE* file, int nucleotides, int showfile);
+static Sequence* input_sequence(SeqFile* file, int nucleotides, int showfile);
 
 static FILE* open_file(int mode, const char* filename, const char* typestr)
 {
-    static const char* rwstr[] = { "w", "r" };
+    static const char* rwstr[] = { "w", "r", "r+" };
 
     char* fullfile = (char*)malloc(sizeof(char) * (strlen(filename) + strlen(typestr) + 2));
     strcpy(fullfile, filename);
@@ -78,162 +105,1079 @@ static FILE* open_file(int mode, const char* filename, const char* typestr)
     return file;
 }
 
-static unsigned input_sequence(FILE* file, int nucleotides, int showfile)
+/* Opens filename.Z-SCORE (and filename.probability if asked for). A checkpoint
+   filename.Z-SCORE.ckpt is kept while the run goes on; with 'resume' the outputs
+   are cut back to the length it records and the run carries on from there. */
+static int open_output(Output* output, const char* filename, int resume)
 {
-    unsigned length, i, j;
-    char c;
-#ifdef USE_MMAP
-    FILE* OUTPUT;
-#endif
+    output->checkpointfile = (char*)malloc(strlen(filename) + 14);
+    sprintf(output->checkpointfile, "%s.Z-SCORE.ckpt", filename);
 
-    printf("inputting sequence\n");
+    Checkpoint checkpoint;
+    if (resume && checkpoint_read(output->checkpointfile, &checkpoint) != 0) {
+        printf("no checkpoint %s, starting from the beginning\n", output->checkpointfile);
+        resume = 0;
+    }
+    if (resume && !checkpoint_matches(&checkpoint, &output->checkpoint)) {
+        printf("checkpoint %s was written with different sizes or options!\n", output->checkpointfile);
+        free(output->checkpointfile);
+        return -1;
+    }
 
-    length = 0; /* count how many bases */
-    while (j = 0, fgets(tempstr, 128, file) != NULL) {
-        while ((c = tempstr[j++]) != 0) {
-            if (c == 'a' || c == 't' || c == 'g' || c == 'c' || c == 'A' || c == 'T' || c == 'G' || c == 'C') {
-                length++;
-            }
+    int mode = resume ? 2 : 0;
+    output->zfile = open_file(mode, filename, "Z-SCORE");
+    if (output->zfile == NULL) {
+        printf("couldn't open %s.Z-SCORE!\n", filename);
+        free(output->checkpointfile);
+        return -1;
+    }
+    output->pfile = NULL;
+    if (output->checkpoint.probability) {
+        output->pfile = open_file(mode, filename, "probability");
+        if (output->pfile == NULL) {
+            printf("couldn't open %s.probability!\n", filename);
         }
     }
 
-#ifndef USE_MMAP
-    sequence = (char*)malloc(length + nucleotides);
-#else
-    sequence = (char*)malloc(nucleotides);
-    OUTPUT = (FILE*)fopen("/usr/local/apache/htdocs/zhunt/temp", "w");
-#endif
+    if (resume) {
+        if (ftruncate(fileno(output->zfile), checkpoint.zoffset) != 0
+            || (output->pfile != NULL && ftruncate(fileno(output->pfile), checkpoint.poffset) != 0)) {
+            printf("couldn't truncate the output to checkpoint %s!\n", output->checkpointfile);
+            close_output(output);
+            return -1;
+        }
+        fseek(output->zfile, 0, SEEK_END);
+        if (output->pfile != NULL) {
+            fseek(output->pfile, 0, SEEK_END);
+        }
+        output->checkpoint = checkpoint;
+        printf("resuming at sequence %zu position %zu\n", checkpoint.record, checkpoint.position);
+    }
+    return 0;
+}
 
-    rewind(file);
+/* records that everything before 'position' of sequence 'record' is written */
+static void checkpoint_output(Output* output, size_t record, size_t position)
+{
+    fflush(output->zfile);
+    output->checkpoint.zoffset = ftell(output->zfile);
+    if (output->pfile != NULL) {
+        fflush(output->pfile);
+        output->checkpoint.poffset = ftell(output->pfile);
+    }
+    if (output->matrix != NULL) {
+        output->checkpoint.moffset = dlmatrix_tell(output->matrix);
+    }
+    output->checkpoint.record = record;
+    output->checkpoint.position = position;
+    if (output->checkpointfile != NULL && checkpoint_write(output->checkpointfile, &output->checkpoint) != 0) {
+        printf("couldn't write %s!\n", output->checkpointfile);
+    }
+}
 
-    if (showfile) {
-        printf("\n");
+/* closes a run; the checkpoint of a finished one is no longer needed, one
+   stopped early or cut short by a failure keeps it and ends its scores with a
+   line saying so */
+static void close_output(Output* output)
+{
+    progress_report(&output->progress, 1);
+    const char* reason = (output->failed != NULL) ? output->failed : progress_stop_reason();
+    if (reason != NULL) {
+        printf("stopped early by %s, complete up to record %zu position %zu\n", reason, output->checkpoint.record, output->checkpoint.position);
+        fprintf(output->zfile, "# partial (%s): complete up to record %zu position %zu\n", reason, output->checkpoint.record, output->checkpoint.position);
     }
-    i = 0;
-    while (j = 0, fgets(tempstr, 128, file) != NULL) {
-        while ((c = tempstr[j++]) != 0) {
-            if (c == 'a' || c == 't' || c == 'g' || c == 'c' || c == 'A' || c == 'T' || c == 'G' || c == 'C') {
-                if (c == 'A') {
-                    c = 'a';
-                }
-                if (c == 'T') {
-                    c = 't';
-                }
-                if (c == 'G') {
-                    c = 'g';
-                };
-                if (c == 'C') {
-                    c = 'c';
-                }
-#ifndef USE_MMAP
-                sequence[i++] = c;
-#else
-                fprintf(OUTPUT, "%c", c);
-                if (i < nucleotides) {
-                    sequence[i++] = c;
-                }
-#endif
-            }
+    if (output->pfile != NULL) {
+        fclose(output->pfile);
+    }
+    fclose(output->zfile);
+    if (output->matrix != NULL) {
+        dlmatrix_close(output->matrix);
+    }
+    if (output->track != NULL && track_close(output->track) != 0) {
+        printf("couldn't write the bedGraph/bigWig track!\n");
+    }
+    if (output->tiles != NULL && tiles_close(output->tiles) != 0) {
+        printf("couldn't write the tiles!\n");
+    }
+    if (output->checkpointfile != NULL) {
+        if (reason == NULL) {
+            remove(output->checkpointfile);
         }
+        free(output->checkpointfile);
     }
+}
+
+/* reads the whole (possibly gzip or BGZF compressed) file in a single pass */
+static Sequence* input_sequence(SeqFile* file, int nucleotides, int showfile)
+{
+    const char* chunk;
+    size_t n;
+
+    printf("inputting sequence\n");
 
-    for (int k = 0; k < nucleotides; k++) /* assume circular nucleotides */
-    {
-#ifndef USE_MMAP
-        sequence[i++] = sequence[k];
-#else
-        fprintf(OUTPUT, "%c", sequence[k]);
-#endif
+    if (showfile) {
+        printf("\n");
+    }
+    Sequence* seq = sequence_new();
+    while ((n = seqfile_read(file, &chunk)) != 0) {
+        sequence_append(seq, chunk, n);
     }
-#ifdef USE_MMAP
-    close(OUTPUT);
-    sequencefile = open("/usr/local/apache/htdocs/zhunt/temp", O_RDWR, NULL);
-    free(sequence);
-    sequence = (char*)mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, sequencefile, 0);
-#endif
+    sequence_finish(seq, nucleotides); /* assume circular nucleotides */
 
-    return length;
+    return seq;
 }
 
-/* calculate the probability of the value 'dl' in a Gaussian distribution */
-/* from "Data Reduction and Error Analysis for the Physical Science" */
-/* Philip R. Bevington, 1969, McGraw-Hill, Inc */
-
-static double assign_probability(double dl)
+/* a comma separated list of at most MAX_SWEEP positive values; returns how many, 0 if malformed */
+static int parse_sweep(const char* list, double* a)
 {
-    static double average = 29.6537135;
-    static double stdv = 2.71997;
-    static double _sqrt2 = 0.70710678118654752440; /* 1/sqrt(2) */
-    static double _sqrtpi = 0.564189583546; /* 1/sqrt(pi) */
-
-    double x, y, z, k, sum;
-
-    z = fabs(dl - average) / stdv;
-    x = z * _sqrt2;
-    y = _sqrtpi * exp(-x * x);
-    z *= z;
-    k = 1.0;
-    sum = 0.0;
+    int n = 0;
+    char* end;
     do {
-        sum += x;
-        k += 2.0;
-        x *= z / k;
-    } while (sum + x > sum);
-    z = 0.5 - y * sum; /* probability of each tail */
-    return (dl > average) ? z : 1.0 / z;
+        if (n == MAX_SWEEP) {
+            return 0;
+        }
+        a[n] = strtod(list, &end);
+        if (end == list || a[n] <= 0.0 || (*end != ',' && *end != '\0')) {
+            return 0;
+        }
+        n++;
+        list = end + 1;
+    } while (*end == ',');
+    return n;
+}
+
+static void usage(void)
+{
+    printf("usage: zhunt [-p] [-r regions.bed [--fai index]] [--sweep a,...] [--matrix file | --query file] [--bedgraph file] [--bigwig file] [--tiles file] [--vcf file] [--scan] [--deadline seconds] [--budget bases] [--resume] [--status file] windowsize minsize maxsize datafile\n");
+    printf("       zhunt --tune [windowsize minsize maxsize]\n");
+    printf("  datafile - reads FASTA or FASTQ records from stdin and writes their scores to stdout\n");
+    printf("  -p, --probability  also write datafile.probability, the sequence aligned with its antisyn\n");
+    printf("  -r, --regions      score only the BED intervals of datafile, an uncompressed indexed FASTA,\n");
+    printf("                     writing one section per region to regions.bed.Z-SCORE\n");
+    printf("      --fai          samtools faidx index of datafile (default datafile.fai)\n");
+    printf("      --vcf file     score only the windows around each haplotype's variants in file against\n");
+    printf("                     datafile, an uncompressed indexed FASTA, writing the changes to file.Z-DELTA\n");
+    printf("      --scan         score every single base substitution of datafile, writing the change of\n");
+    printf("                     the lowest dl and probability around each base to datafile.Z-SCAN\n");
+    printf("      --sweep a,...  score for each supercoiling parameter a (default 0.357), one column set each\n");
+    printf("      --matrix file  also store every window size's dl and antisyn, up to maxsize, in file\n");
+    printf("      --query file   rescore minsize..maxsize from a stored matrix instead of searching\n");
+    printf("      --bedgraph file, --bigwig file\n");
+    printf("                     also write the probability as a bedGraph or an indexed bigWig track\n");
+    printf("      --tiles file   also write min/max/mean dl and probability over bins of 16, 32, ... bases\n");
+    printf("      --deadline seconds, --budget bases\n");
+    printf("                     stop after so long or so many bases scored, as on SIGTERM, keeping what is\n");
+    printf("                     done and marking the output partial (exit status 2)\n");
+    printf("      --resume       continue an interrupted run from its last checkpoint\n");
+    printf("      --status file  write progress to file instead of stderr\n");
+    printf("      --tune         time the search variants, thread counts and chunk sizes on this host for\n");
+    printf("                     these window sizes (default 12 6 12) and cache the fastest for later runs\n");
+    exit(1);
 }
 
 int main(int argc, char* argv[])
 {
-    static double a = 0.357;
+    double a[MAX_SWEEP] = { 0.357 }; /* supercoiling parameter(s) */
+    int na = 1;
+    static const struct option longopts[] = {
+        { "probability", no_argument, NULL, 'p' },
+        { "regions", required_argument, NULL, 'r' },
+        { "fai", required_argument, NULL, 'f' },
+        { "resume", no_argument, NULL, 'R' },
+        { "status", required_argument, NULL, 's' },
+        { "sweep", required_argument, NULL, 'a' },
+        { "matrix", required_argument, NULL, 'm' },
+        { "query", required_argument, NULL, 'q' },
+        { "bedgraph", required_argument, NULL, 'g' },
+        { "bigwig", required_argument, NULL, 'w' },
+        { "tiles", required_argument, NULL, 't' },
+        { "vcf", required_argument, NULL, 'v' },
+        { "scan", no_argument, NULL, 'S' },
+        { "deadline", required_argument, NULL, 'D' },
+        { "budget", required_argument, NULL, 'B' },
+        { "tune", no_argument, NULL, 'T' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int showprobability = 0;
+    const char* bedfilename = NULL;
+    const char* faifilename = NULL;
+    const char* statusfile = NULL;
+    const char* matrixfile = NULL;
+    const char* queryfile = NULL;
+    const char* bedgraphfile = NULL;
+    const char* bigwigfile = NULL;
+    const char* tilesfile = NULL;
+    const char* vcffilename = NULL;
+    int resume = 0;
+    int scan = 0;
+    int tune = 0;
+    double deadline = 0.0;
+    size_t budget = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "pr:", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'p':
+            showprobability = 1;
+            break;
+        case 'r':
+            bedfilename = optarg;
+            break;
+        case 'f':
+            faifilename = optarg;
+            break;
+        case 'R':
+            resume = 1;
+            break;
+        case 's':
+            statusfile = optarg;
+            break;
+        case 'a':
+            na = parse_sweep(optarg, a);
+            if (na == 0) {
+                usage();
+            }
+            break;
+        case 'm':
+            matrixfile = optarg;
+            break;
+        case 'q':
+            queryfile = optarg;
+            break;
+        case 'g':
+            bedgraphfile = optarg;
+            break;
+        case 'w':
+            bigwigfile = optarg;
+            break;
+        case 't':
+            tilesfile = optarg;
+            break;
+        case 'v':
+            vcffilename = optarg;
+            break;
+        case 'S':
+            scan = 1;
+            break;
+        case 'D':
+            deadline = atof(optarg);
+            break;
+        case 'B':
+            budget = strtoull(optarg, NULL, 10);
+            break;
+        case 'T':
+            tune = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (tune) {
+        if (argc - optind != 0 && argc - optind != 3) {
+            usage();
+        }
+        int sizes[3] = { 12, 6, 12 }; /* as the web front end runs */
+        for (int k = 0; k < argc - optind; k++) {
+            sizes[k] = atoi(argv[optind + k]);
+        }
+        delta_linking_init(sizes[0]);
+        INSTRUMENT_INIT();
+        calculate_tune(sizes[0], sizes[1], sizes[2]);
+        INSTRUMENT_DUMP();
+        delta_linking_destroy();
+        return 0;
+    }
+    int streaming = argc - optind >= 4 && strcmp(argv[optind + 3], "-") == 0;
+    if (argc - optind < 4 || (queryfile != NULL && (matrixfile != NULL || bedfilename != NULL || na > 1))
+        || (matrixfile != NULL && bedfilename != NULL)
+        || ((bedgraphfile != NULL || bigwigfile != NULL || tilesfile != NULL) && (bedfilename != NULL || resume))
+        || (streaming && (bedfilename != NULL || resume || showprobability || matrixfile != NULL || queryfile != NULL))
+        || (vcffilename != NULL && (streaming || bedfilename != NULL || resume || showprobability || matrixfile != NULL || queryfile != NULL || na > 1
+                                       || bedgraphfile != NULL || bigwigfile != NULL || tilesfile != NULL))
+        || (scan && (streaming || vcffilename != NULL || bedfilename != NULL || resume || showprobability || matrixfile != NULL || queryfile != NULL
+                        || na > 1 || bedgraphfile != NULL || bigwigfile != NULL || tilesfile != NULL))) {
+        usage();
+    }
+    argv += optind;
 
-    if (argc < 5) {
-        printf("usage: zhunt windowsize minsize maxsize datafile\n");
-        exit(1);
+    FILE* stream = NULL;
+    if (streaming) {
+        /* the results go to stdout, everything else to stderr */
+        int fd = dup(STDOUT_FILENO);
+        stream = (fd >= 0) ? fdopen(fd, "w") : NULL;
+        if (stream == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            printf("couldn't write to stdout!\n");
+            return 1;
+        }
     }
-    tempstr = (char*)malloc(128);
 
-    int dinucleotides = atoi((char*)argv[1]);
+    int dinucleotides = atoi((char*)argv[0]);
 
-    int min = atoi((char*)argv[2]);
-    int max = atoi((char*)argv[3]);
+    int min = atoi((char*)argv[1]);
+    int max = atoi((char*)argv[2]);
 
     printf("dinucleotides %d\n", dinucleotides);
     printf("min/max %d %d\n", min, max);
-    printf("operating on %s\n", (char*)argv[4]);
+    printf("operating on %s\n", (char*)argv[3]);
+
+    DlMatrix* query = NULL;
+    if (queryfile != NULL) {
+        query = dlmatrix_open(queryfile);
+        if (query == NULL) {
+            printf("couldn't read %s!\n", queryfile);
+            return 1;
+        }
+        na = query->na; /* the stored values of 'a' */
+        memcpy(a, query->a, na * sizeof(double));
+    }
+
+    /* tuned for the window sizes this run scores, or else the defaults */
+    int tunedto = (max > dinucleotides) ? dinucleotides : max;
+    int tunedfrom = (min > tunedto) ? tunedto : min;
+    Tuning tuning;
+    if (tune_load(tunedfrom, tunedto, &tuning) == 0) {
+        /* OMP_NUM_THREADS, as the job queue sets it, has the last word */
+        if (getenv("OMP_NUM_THREADS") == NULL) {
+            omp_set_num_threads(tuning.threads);
+        }
+        score_chunk = tuning.chunk;
+        tune_search(&tuning);
+        printf("tuned for this host: %d threads, chunks of %d, %s search, %s coefficients, %s kernels\n", tuning.threads, tuning.chunk,
+            tuning.lanes ? "lane" : "scalar", tuning.incremental ? "carried" : "full", tuning.specialized ? "specialized" : "generic");
+    }
 
     delta_linking_init(dinucleotides);
+    INSTRUMENT_INIT();
+    progress_limit(deadline, budget);
 
-    calculate_zscore(a, dinucleotides, min, max, (char*)argv[4]);
-    analyze_zscore((char*)argv[4]);
+    int failed = 0;
+    if (streaming) {
+        calculate_stream(a, na, dinucleotides, min, max, stream, statusfile, bedgraphfile, bigwigfile, tilesfile);
+    } else if (scan) {
+        calculate_scan(a[0], dinucleotides, min, max, (char*)argv[3], statusfile);
+    } else if (vcffilename != NULL) {
+        calculate_variants(a[0], dinucleotides, min, max, (char*)argv[3], vcffilename, faifilename);
+    } else if (bedfilename != NULL) {
+        calculate_regions(a, na, dinucleotides, min, max, (char*)argv[3], bedfilename, faifilename, showprobability, resume, statusfile);
+    } else {
+        failed = calculate_zscore(a, na, dinucleotides, min, max, (char*)argv[3], showprobability, resume, statusfile, matrixfile, query, bedgraphfile, bigwigfile, tilesfile);
+    }
+    if (query != NULL) {
+        dlmatrix_close(query);
+    }
 
-    free(tempstr);
+    INSTRUMENT_DUMP();
     delta_linking_destroy();
-    return 0;
+    if (failed) {
+        return 1;
+    }
+    return (progress_stop_reason() != NULL) ? 2 : 0;
 }
 
-static void calculate_zscore(double a, int maxdinucleotides, int min, int max, char* filename)
+#define MATRIX_BLOCK (1 << 17) /* positions per block when a dl matrix is written or read */
+
+/* Scores sequence 'record' of the run from position 'resume' on, checkpointing
+   after each block. With 'query' the positions are rescored from the stored dl
+   matrix, whose section for this sequence comes next. Returns nonzero if the run
+   was stopped early, having written the chunks done before that in order, or if
+   the query matrix doesn't match, which also marks the output failed. */
+static int score_sequence(const Sequence* seq, const char* name, const double* a, int na, int fromdin, int todin, size_t record, size_t resume, Output* output, DlMatrix* query)
 {
-    static const double pideg = 57.29577951; /* 180/pi */
+    int nucleotides = 2 * todin;
+    size_t seqlength = seq->length;
+    FILE* zfile = output->zfile;
+    FILE* pfile = output->pfile;
+
+    if (resume == 0) {
+        fprintf(zfile, "%s %zu %d %d", name, seqlength, fromdin, todin);
+        write_sweep(zfile, output->checkpoint.a, na);
+        fprintf(zfile, "\n");
+        if (output->matrix != NULL && dlmatrix_write_section(output->matrix, name, seqlength) != 0) {
+            printf("couldn't write the dl matrix!\n");
+        }
+        /* a FASTA file is named by its header */
+        const char* chrom = (seq->name != NULL && seq->name[0] != '\0') ? seq->name : name;
+        if (output->track != NULL) {
+            track_begin(output->track, chrom, seqlength);
+        }
+        if (output->tiles != NULL) {
+            tiles_begin(output->tiles, chrom, seqlength);
+        }
+    }
+    if (query != NULL) {
+        size_t length;
+        if (dlmatrix_read_section(query, &length) != 0 || length != seqlength || dlmatrix_skip(query, resume) != 0) {
+            printf("the dl matrix doesn't match %s!\n", name);
+            output->failed = "dl matrix";
+            return 1;
+        }
+    }
+
+    /* na results per position, the block shrinks to keep memory the same */
+    DlMatrix* matrix = (query != NULL) ? query : output->matrix;
+    size_t limit = (matrix != NULL) ? MATRIX_BLOCK / na : SCORE_BLOCK / na;
+    size_t block = (seqlength < limit) ? seqlength : limit;
+    size_t stride = (matrix != NULL) ? (size_t)na * matrix->todin : 0; /* DinScores per position */
+    DinScore* scores = (matrix != NULL) ? (DinScore*)malloc(block * stride * sizeof(DinScore)) : NULL;
+    Result* results = (Result*)malloc(block * na * sizeof(Result));
+    char* antisyn = (char*)malloc(block * na * (nucleotides + 1));
+    for (size_t i = 0; i < block * na; i++) {
+        results[i].antisyn = antisyn + i * (nucleotides + 1);
+    }
+    char* complete = (char*)malloc((block + score_chunk - 1) / score_chunk);
+
+    int stopped = 0;
+    for (size_t first = resume; first < seqlength && !stopped; first += block) {
+        size_t count = (seqlength - first < block) ? seqlength - first : block;
+        size_t nchunks = (count + score_chunk - 1) / score_chunk;
+        memset(complete, 0, nchunks);
+        if (query != NULL && dlmatrix_read(query, scores, count) != 0) {
+            printf("the dl matrix is truncated!\n");
+            output->failed = "dl matrix";
+            stopped = 1;
+            break;
+        }
+        #pragma omp parallel default(shared)
+        {
+            SequenceChunk chunk = { 0 };
+            #pragma omp for schedule(dynamic)
+            for (size_t c = 0; c < nchunks; c++) {
+                if (progress_stopped(&output->progress)) {
+                    continue;
+                }
+                size_t start = first + c * score_chunk;
+                size_t end = (start + score_chunk < first + count) ? start + score_chunk : first + count;
+                int loaded = 0;
+                for (size_t i = start; i < end;) {
+                    DinScore* row = (scores != NULL) ? &scores[(i - first) * stride] : NULL;
+                    /* the stored run saw a gap in its wider window */
+                    if (sequence_has_gap(seq, i, nucleotides) || (query != NULL && isnan(row[0].dl))) {
+                        for (int k = 0; k < na; k++) {
+                            no_result(&results[(i - first) * na + k]);
+                        }
+                        for (size_t j = 0; query == NULL && j < stride; j++) {
+                            row[j] = (DinScore) { NAN, 0 };
+                        }
+                        i++;
+                        continue;
+                    }
+                    if (!loaded) { /* chunks lying in a gap are never decoded */
+                        INSTRUMENT_BEGIN(PHASE_INDEX);
+                        sequence_load(seq, start, end - start + nucleotides, &chunk);
+                        INSTRUMENT_END(PHASE_INDEX);
+                        loaded = 1;
+                    }
+                    if (query != NULL) {
+                        zscore_window_query(sequence_chunk_window(&chunk, i), row, na, query->todin, fromdin, todin, &results[(i - first) * na]);
+                        i++;
+                        continue;
+                    }
+                    /* the run of windows up to the next gap, ANTISYN_LANES at a time */
+                    const bzindex_t* windows[ANTISYN_LANES];
+                    int n = 0;
+                    do {
+                        windows[n] = sequence_chunk_window(&chunk, i + n);
+                        n++;
+                    } while (n < ANTISYN_LANES && i + n < end && !sequence_has_gap(seq, i + n, nucleotides));
+                    zscore_windows(windows, n, a, na, fromdin, todin, &results[(i - first) * na], row);
+                    i += n;
+                }
+                progress_add(&output->progress, end - start);
+                if (omp_get_thread_num() == 0) {
+                    progress_report(&output->progress, 0);
+                }
+                complete[c] = 1;
+            }
+            sequence_chunk_free(&chunk);
+        }
+        /* a stop leaves the chunks handed out before it done, in order */
+        size_t done = 0;
+        while (done < nchunks && complete[done]) {
+            done++;
+        }
+        if (done < nchunks) {
+            count = done * score_chunk;
+            stopped = 1;
+        }
 
+        INSTRUMENT_BEGIN(PHASE_OUTPUT);
+        for (size_t i = 0; i < count; ++i) {
+            write_result(zfile, &results[i * na], na);
+            if (pfile != NULL) {
+                show_probability(pfile, first + i, seq, first + i, &results[i * na]);
+            }
+            if (output->track != NULL) {
+                track_add(output->track, first + i, results[i * na].probability);
+            }
+            if (output->tiles != NULL) {
+                tiles_add(output->tiles, results[i * na].dl, results[i * na].probability);
+            }
+        }
+        if (output->matrix != NULL && dlmatrix_write(output->matrix, scores, count) != 0) {
+            printf("couldn't write the dl matrix!\n");
+        }
+        INSTRUMENT_END(PHASE_OUTPUT);
+        checkpoint_output(output, record, first + count);
+    }
+    free(complete);
+    free(scores);
+    free(antisyn);
+    free(results);
+    return stopped;
+}
+
+static int calculate_zscore(const double* a, int na, int maxdinucleotides, int min, int max, char* filename, int showprobability, int resume, const char* statusfile, const char* matrixfile, DlMatrix* query, const char* bedgraphfile, const char* bigwigfile, const char* tilesfile)
+{
     printf("calculating zscore\n");
 
-    FILE* infile = open_file(1, filename, "");
+    printf("opening %s\n", filename);
+    TwoBit* twobit = NULL;
+    Sequence* sequence = NULL;
+    if (twobit_detect(filename)) {
+        twobit = twobit_open(filename);
+        if (twobit == NULL) {
+            printf("couldn't read %s!\n", filename);
+            return 1;
+        }
+    } else {
+        SeqFile* infile = seqfile_open(filename);
+        if (infile == NULL) {
+            printf("couldn't open %s!\n", filename);
+            return 1;
+        }
+        sequence = input_sequence(infile, 2 * maxdinucleotides, 0);
+        int inerror = seqfile_error(infile);
+        seqfile_close(infile);
+        if (inerror) {
+            printf("couldn't read %s!\n", filename);
+            sequence_free(sequence);
+            return 1;
+        }
+    }
+
+    int todin = max;
+    if (todin > maxdinucleotides) {
+        todin = maxdinucleotides;
+    }
+
+    int fromdin = min;
+    if (fromdin > todin) {
+        fromdin = todin;
+    }
+
+    if ((query != NULL && todin > query->todin) || (matrixfile != NULL && todin > MAX_MATRIX_DIN)) {
+        printf("the dl matrix holds window sizes up to %d only!\n", (query != NULL) ? query->todin : MAX_MATRIX_DIN);
+        if (twobit != NULL) {
+            twobit_close(twobit);
+        } else {
+            sequence_free(sequence);
+        }
+        return 1;
+    }
+
+    if (showprobability) {
+        printf("show_probability\n");
+    }
+    Output output = { .checkpoint = { .windowsize = maxdinucleotides, .fromdin = fromdin, .todin = todin, .probability = showprobability, .na = na } };
+    memcpy(output.checkpoint.a, a, na * sizeof(double));
+    if (open_output(&output, filename, resume) != 0) {
+        if (twobit != NULL) {
+            twobit_close(twobit);
+        } else {
+            sequence_free(sequence);
+        }
+        return 1;
+    }
+    const Checkpoint* checkpoint = &output.checkpoint;
+    if (matrixfile != NULL) {
+        /* a resumed run carries on with the matrix it was writing */
+        printf("opening %s\n", matrixfile);
+        if (checkpoint->zoffset == 0 || checkpoint->moffset > 0) {
+            output.matrix = dlmatrix_create(matrixfile, maxdinucleotides, todin, na, a, checkpoint->moffset);
+        }
+        if (output.matrix == NULL) {
+            printf("couldn't open %s!\n", matrixfile);
+        }
+    }
+    open_tracks(&output, bedgraphfile, bigwigfile, tilesfile);
+
+    size_t total = 0, done = 0;
+    for (size_t r = 0; r < ((twobit != NULL) ? twobit->count : 1); r++) {
+        size_t length = (twobit != NULL) ? twobit->records[r].length : sequence->length;
+        total += length;
+        done += (r < checkpoint->record) ? length : (r == checkpoint->record) ? checkpoint->position : 0;
+        if (query != NULL && r < checkpoint->record && length > 0) {
+            size_t stored;
+            if (dlmatrix_read_section(query, &stored) != 0 || dlmatrix_skip(query, stored) != 0) {
+                printf("the dl matrix is truncated!\n");
+                output.failed = "dl matrix";
+            }
+        }
+    }
+    progress_init(&output.progress, total, done, statusfile);
+
+    double halfa[na];
+    for (int k = 0; k < na; k++) {
+        halfa[k] = a[k] / 2.0;
+    }
+    antisyn_init();
+
+    long begintime, endtime;
+    time(&begintime);
+    if (output.failed != NULL) {
+        /* nothing is scored against a matrix that ends before the checkpoint */
+    } else if (twobit != NULL) {
+        /* one section per sequence, decoded straight from the mapped file */
+        for (size_t r = checkpoint->record; r < twobit->count; r++) {
+            const TwoBitRecord* record = &twobit->records[r];
+            size_t nbases = 0, maskbases = 0;
+            for (size_t k = 0; k < record->nblocks; k++) {
+                nbases += record->nsizes[k];
+            }
+            for (size_t k = 0; k < record->maskblocks; k++) {
+                maskbases += record->masksizes[k];
+            }
+            printf("%s: %zu bases, %zu in N blocks, %zu soft-masked\n", record->name, record->length, nbases, maskbases);
+            if (record->length == 0) {
+                continue;
+            }
+            Sequence* view = sequence_view(record->packed, record->length, 2 * maxdinucleotides);
+            for (size_t k = 0; k < record->nblocks; k++) {
+                sequence_add_gap(view, record->nstarts[k], record->nsizes[k]);
+            }
+            size_t resumeposition = (r == checkpoint->record) ? checkpoint->position : 0;
+            int stopped = score_sequence(view, record->name, halfa, na, fromdin, todin, r, resumeposition, &output, query);
+            sequence_free(view);
+            if (stopped) {
+                break;
+            }
+        }
+    } else {
+        score_sequence(sequence, filename, halfa, na, fromdin, todin, 0, checkpoint->position, &output, query);
+    }
+    time(&endtime);
+    int failed = (output.failed != NULL);
+
+    antisyn_destroy();
+    close_output(&output);
+    printf("\n run time=%ld sec\n", endtime - begintime);
+    if (twobit != NULL) {
+        twobit_close(twobit);
+    } else {
+        sequence_free(sequence);
+    }
+    return failed;
+}
+
+static void open_tracks(Output* output, const char* bedgraphfile, const char* bigwigfile, const char* tilesfile)
+{
+    if (bedgraphfile != NULL || bigwigfile != NULL) {
+        output->track = track_open(bedgraphfile, bigwigfile);
+        if (output->track == NULL) {
+            printf("couldn't open the bedGraph/bigWig track!\n");
+        }
+    }
+    if (tilesfile != NULL) {
+        output->tiles = tiles_open(tilesfile);
+        if (output->tiles == NULL) {
+            printf("couldn't open %s!\n", tilesfile);
+        }
+    }
+}
+
+/* Scores the FASTA or FASTQ records of standard input one at a time, as they
+   arrive; each is a section of 'zfile', written out as soon as it is scored. */
+static void calculate_stream(const double* a, int na, int maxdinucleotides, int min, int max, FILE* zfile, const char* statusfile, const char* bedgraphfile, const char* bigwigfile, const char* tilesfile)
+{
+    printf("calculating zscore for the records of standard input\n");
+
+    int todin = (max < maxdinucleotides) ? max : maxdinucleotides;
+    int fromdin = (min < todin) ? min : todin;
+    Output output = { .zfile = zfile, .checkpoint = { .windowsize = maxdinucleotides, .fromdin = fromdin, .todin = todin, .na = na } };
+    memcpy(output.checkpoint.a, a, na * sizeof(double));
+    open_tracks(&output, bedgraphfile, bigwigfile, tilesfile);
+    progress_init(&output.progress, 0, 0, statusfile); /* the total grows with every record */
+
+    double halfa[na];
+    for (int k = 0; k < na; k++) {
+        halfa[k] = a[k] / 2.0;
+    }
+    antisyn_init();
+
+    SeqFile* infile = seqfile_open("-");
+    RecordReader* reader = records_open(infile);
+    Record record;
+    size_t r = 0;
+    int status;
+    while ((status = records_next(reader, &record)) > 0) {
+        r++;
+        Sequence* seq = sequence_new();
+        sequence_append(seq, record.bases, record.length);
+        sequence_finish(seq, 2 * maxdinucleotides);
+        if (seq->length > 0) {
+            char unnamed[32];
+            snprintf(unnamed, sizeof(unnamed), "record%zu", r);
+            output.progress.total += seq->length;
+            if (score_sequence(seq, (record.name[0] != '\0') ? record.name : unnamed, halfa, na, fromdin, todin, r - 1, 0, &output, NULL)) {
+                sequence_free(seq);
+                break;
+            }
+        }
+        sequence_free(seq);
+    }
+    if (status < 0 || seqfile_error(infile)) {
+        printf("couldn't read record %zu of standard input!\n", r + 1);
+    }
+    records_close(reader);
+    seqfile_close(infile);
+
+    antisyn_destroy();
+    close_output(&output);
+}
+
+/* the lowest dl of the windows lying wholly in 'bases', NaN if all of them hold ambiguous bases */
+static double lowest_dl(const char* bases, size_t n, double a, int fromdin, int todin, int maxdinucleotides)
+{
+    size_t nucleotides = 2 * todin;
+    Sequence* seq = sequence_new();
+    sequence_append(seq, bases, n);
+    sequence_finish(seq, 2 * maxdinucleotides);
+    size_t windows = (seq->length >= nucleotides) ? seq->length - nucleotides + 1 : 0;
+    SequenceChunk chunk = { 0 };
+    if (windows > 0) {
+        sequence_load(seq, 0, seq->length, &chunk);
+    }
+
+    Result results[ANTISYN_LANES];
+    char antisyn[ANTISYN_LANES][nucleotides + 1];
+    for (int j = 0; j < ANTISYN_LANES; j++) {
+        results[j].antisyn = antisyn[j];
+    }
+    double lowest = NAN;
+    for (size_t i = 0; i < windows;) {
+        if (sequence_has_gap(seq, i, nucleotides)) {
+            i++;
+            continue;
+        }
+        const bzindex_t* window[ANTISYN_LANES];
+        int count = 0;
+        do {
+            window[count] = sequence_chunk_window(&chunk, i + count);
+            count++;
+        } while (count < ANTISYN_LANES && i + count < windows && !sequence_has_gap(seq, i + count, nucleotides));
+        zscore_windows(window, count, &a, 1, fromdin, todin, results, NULL);
+        for (int j = 0; j < count; j++) {
+            if (isnan(lowest) || results[j].dl < lowest) {
+                lowest = results[j].dl;
+            }
+        }
+        i += count;
+    }
+    sequence_chunk_free(&chunk);
+    sequence_free(seq);
+    return lowest;
+}
+
+/* scores the reference windows overlapping the cluster, and the same stretch
+   with its changes made */
+static void score_cluster(const Reference* reference, const FaiEntry* entry, Cluster* cluster, double a, int fromdin, int todin, int maxdinucleotides)
+{
+    size_t nucleotides = 2 * todin;
+    if (cluster->end > entry->length) {
+        cluster->refdl = cluster->altdl = NAN;
+        return;
+    }
+    size_t left = (cluster->start + 1 > nucleotides) ? cluster->start + 1 - nucleotides : 0;
+    size_t right = (cluster->end + nucleotides - 1 < entry->length) ? cluster->end + nucleotides - 1 : entry->length;
+    char* ref = (char*)malloc(right - left);
+    reference_fetch(reference, entry, left, right, 0, ref);
+
+    size_t altlength = right - left;
+    for (int c = 0; c < cluster->nchanges; c++) {
+        altlength += strlen(cluster->changes[c].alt) - cluster->changes[c].reflength;
+    }
+    char* alt = (char*)malloc(altlength + 1);
+    size_t from = left, n = 0;
+    for (int c = 0; c < cluster->nchanges; c++) {
+        const Change* change = &cluster->changes[c];
+        memcpy(alt + n, ref + (from - left), change->pos - from);
+        n += change->pos - from;
+        memcpy(alt + n, change->alt, strlen(change->alt));
+        n += strlen(change->alt);
+        from = change->pos + change->reflength;
+    }
+    memcpy(alt + n, ref + (from - left), right - from);
+
+    cluster->refdl = lowest_dl(ref, right - left, a, fromdin, todin, maxdinucleotides);
+    cluster->altdl = lowest_dl(alt, altlength, a, fromdin, todin, maxdinucleotides);
+    free(alt);
+    free(ref);
+}
+
+/* Each haplotype's alleles are scored as clusters of those close enough to
+   share a window, against the reference; identical clusters are scored once
+   for all their carriers. Only the windows overlapping a cluster are scored,
+   so the work follows the number of distinct clusters, not the genome size. */
+static void calculate_variants(double a, int maxdinucleotides, int min, int max, char* filename, const char* vcffilename, const char* faifilename)
+{
+    printf("calculating zscore changes for variants\n");
+
+    char* defaultfai = NULL;
+    if (faifilename == NULL) {
+        defaultfai = (char*)malloc(strlen(filename) + 5);
+        sprintf(defaultfai, "%s.fai", filename);
+        faifilename = defaultfai;
+    }
+    printf("opening %s\n", filename);
+    Reference* reference = reference_open(filename, faifilename);
+    free(defaultfai);
+    if (reference == NULL) {
+        return;
+    }
+
+    int todin = max;
+    if (todin > maxdinucleotides) {
+        todin = maxdinucleotides;
+    }
+
+    int fromdin = min;
+    if (fromdin > todin) {
+        fromdin = todin;
+    }
+
+    printf("opening %s\n", vcffilename);
+    VcfReader* vcf = vcf_open(vcffilename, 2 * todin);
+    if (vcf == NULL) {
+        printf("couldn't open %s!\n", vcffilename);
+        reference_close(reference);
+        return;
+    }
+    FILE* zfile = open_file(0, vcffilename, "Z-DELTA");
+    if (zfile == NULL) {
+        printf("couldn't open %s.Z-DELTA!\n", vcffilename);
+        vcf_close(vcf);
+        reference_close(reference);
+        return;
+    }
+    fprintf(zfile, "#chrom\tstart\tend\tchanges\thaplotypes\tcarriers\tref_dl\talt_dl\tddl\tref_probability\talt_probability\tdprobability\n");
+
+    double halfa = a / 2.0;
+    antisyn_init();
+
+    long begintime, endtime;
+    time(&begintime);
+    const char* chrom;
+    Cluster** clusters;
+    size_t count, total = 0;
+    char* skipped = NULL;
+    Progress progress;
+    progress_init(&progress, 0, 0, NULL);
+    while (!progress_stopped(&progress) && vcf_next(vcf, &chrom, &clusters, &count)) {
+        const FaiEntry* entry = reference_find(reference, chrom);
+        if (entry == NULL) {
+            if (skipped == NULL || strcmp(skipped, chrom) != 0) {
+                printf("skipping the variants of %s, which isn't in %s\n", chrom, filename);
+                free(skipped);
+                skipped = strdup(chrom);
+            }
+            continue;
+        }
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t c = 0; c < count; c++) {
+            score_cluster(reference, entry, clusters[c], halfa, fromdin, todin, maxdinucleotides);
+        }
+        INSTRUMENT_BEGIN(PHASE_OUTPUT);
+        for (size_t c = 0; c < count; c++) {
+            const Cluster* cluster = clusters[c];
+            double refprobability = assign_probability(cluster->refdl);
+            double altprobability = assign_probability(cluster->altdl);
+            fprintf(zfile, "%s\t%zu\t%zu\t%s\t%zu\t%s\t%.3f\t%.3f\t%.3f\t%e\t%e\t%e\n", chrom, cluster->start, cluster->end,
+                cluster->key, cluster->ncarriers, (cluster->carriers != NULL) ? cluster->carriers : "-", cluster->refdl, cluster->altdl,
+                cluster->altdl - cluster->refdl, refprobability, altprobability, altprobability - refprobability);
+        }
+        INSTRUMENT_END(PHASE_OUTPUT);
+        total += count;
+    }
+    time(&endtime);
+    if (progress_stop_reason() != NULL) {
+        printf("stopped early by %s\n", progress_stop_reason());
+        fprintf(zfile, "# partial (%s): %zu clusters scored\n", progress_stop_reason(), total);
+    }
+    printf("%zu clusters\n run time=%ld sec\n", total, endtime - begintime);
+
+    free(skipped);
+    antisyn_destroy();
+    fclose(zfile);
+    vcf_close(vcf);
+    reference_close(reference);
+}
+
+/* Bases are scanned SCAN_BLOCK at a time; a block's windows, all those holding
+   one of its bases, are scored in parallel, each for all its substitutions. */
+#define SCAN_BLOCK (1 << 14)
+
+/* For each base and each of the other three bases it could be made, the change
+   of the lowest dl among the windows holding it, and of its probability. The
+   windows wrap around the end of the sequence, as in a full run. */
+static void calculate_scan(double a, int maxdinucleotides, int min, int max, char* filename, const char* statusfile)
+{
+    printf("calculating zscore changes for every substitution\n");
+
+    printf("opening %s\n", filename);
+    if (twobit_detect(filename)) {
+        printf("--scan doesn't read .2bit files!\n");
+        return;
+    }
+    SeqFile* infile = seqfile_open(filename);
     if (infile == NULL) {
         printf("couldn't open %s!\n", filename);
         return;
     }
-    unsigned int seqlength = input_sequence(infile, 2 * maxdinucleotides, 0);
-    fclose(infile);
+    Sequence* seq = input_sequence(infile, 2 * maxdinucleotides, 0);
+    int inerror = seqfile_error(infile);
+    seqfile_close(infile);
+    if (inerror) {
+        printf("couldn't read %s!\n", filename);
+        sequence_free(seq);
+        return;
+    }
 
-    FILE* zfile = open_file(0, filename, "Z-SCORE");
+    int todin = max;
+    if (todin > maxdinucleotides) {
+        todin = maxdinucleotides;
+    }
+
+    int fromdin = min;
+    if (fromdin > todin) {
+        fromdin = todin;
+    }
+
+    size_t nucleotides = 2 * todin;
+    size_t length = seq->length;
+    if (length < nucleotides) {
+        printf("%s is shorter than a window!\n", filename);
+        sequence_free(seq);
+        return;
+    }
+    FILE* zfile = open_file(0, filename, "Z-SCAN");
     if (zfile == NULL) {
-#ifndef USE_MMAP
-        free(sequence);
-#else
-        munmap(sequence, seqlength);
-        close(sequencefile);
-#endif
+        printf("couldn't open %s.Z-SCAN!\n", filename);
+        sequence_free(seq);
+        return;
+    }
+    fprintf(zfile, "%s %zu %d %d\n", filename, length, fromdin, todin);
+
+    Progress progress;
+    progress_init(&progress, length, 0, statusfile);
+    double halfa = a / 2.0;
+    antisyn_init();
+
+    /* window w of a block, with its base j made c, has dl[(w * nucleotides + j) * 4 + c] */
+    size_t nwindows = SCAN_BLOCK + nucleotides - 1;
+    double* dl = (double*)malloc(nwindows * nucleotides * 4 * sizeof(double));
+    char* gap = (char*)malloc(nwindows);
+    double(*lowest)[4] = malloc(SCAN_BLOCK * sizeof(*lowest));
+    SequenceChunk chunk = { 0 }; /* the windows of a block */
+    static const int alphabetical[4] = { 0, 3, 2, 1 }; /* codes of a, c, g, t */
+
+    long begintime, endtime;
+    time(&begintime);
+    size_t first;
+    for (first = 0; first < length && !progress_stopped(&progress); first += SCAN_BLOCK) {
+        size_t count = (length - first < SCAN_BLOCK) ? length - first : SCAN_BLOCK;
+        /* the windows from first - nucleotides + 1 on, around the start */
+        size_t origin = (first + length - (nucleotides - 1)) % length;
+        size_t windows = count + nucleotides - 1;
+        sequence_load(seq, origin, windows + nucleotides - 1, &chunk);
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (size_t w = 0; w < windows; w++) {
+            gap[w] = sequence_has_gap(seq, (origin + w) % length, nucleotides);
+            if (!gap[w]) {
+                zscore_window_scan(sequence_chunk_window(&chunk, origin + w), halfa, fromdin, todin, (double(*)[4])&dl[w * nucleotides * 4]);
+            }
+        }
+
+        /* base p is base j of window p + nucleotides - 1 - j */
+        #pragma omp parallel for
+        for (size_t p = 0; p < count; p++) {
+            for (int c = 0; c < 4; c++) {
+                lowest[p][c] = NAN;
+                for (size_t j = 0; j < nucleotides; j++) {
+                    size_t w = p + nucleotides - 1 - j;
+                    double value = dl[(w * nucleotides + j) * 4 + c];
+                    if (!gap[w] && (isnan(lowest[p][c]) || value < lowest[p][c])) {
+                        lowest[p][c] = value;
+                    }
+                }
+            }
+        }
+
+        INSTRUMENT_BEGIN(PHASE_OUTPUT);
+        for (size_t p = 0; p < count; p++) {
+            if (sequence_has_gap(seq, first + p, 1)) {
+                fprintf(zfile, "n - nan nan - nan nan - nan nan\n");
+                continue;
+            }
+            int own = sequence_chunk_window(&chunk, origin + p + nucleotides - 1)[0] >> 2;
+            double ownprobability = assign_probability(lowest[p][own]);
+            fprintf(zfile, "%c", "atgc"[own]);
+            for (int k = 0; k < 4; k++) {
+                int c = alphabetical[k];
+                if (c != own) {
+                    fprintf(zfile, " %c %7.3lf %le", "atgc"[c], lowest[p][c] - lowest[p][own], assign_probability(lowest[p][c]) - ownprobability);
+                }
+            }
+            fprintf(zfile, "\n");
+        }
+        INSTRUMENT_END(PHASE_OUTPUT);
+        progress_add(&progress, count);
+        progress_report(&progress, 0);
+    }
+    time(&endtime);
+    progress_report(&progress, 1);
+    if (first < length) {
+        printf("stopped early by %s\n", progress_stop_reason());
+        fprintf(zfile, "# partial (%s): complete up to position %zu\n", progress_stop_reason(), first);
+    }
+    printf("\n run time=%ld sec\n", endtime - begintime);
+
+    sequence_chunk_free(&chunk);
+    free(lowest);
+    free(gap);
+    free(dl);
+    antisyn_destroy();
+    fclose(zfile);
+    sequence_free(seq);
+}
+
+/* Regions are scored in batches of at most REGION_BATCH positions; positions of
+   all the regions in a batch share one parallel loop so that a mix of short and
+   long intervals keeps every thread busy. */
+#define REGION_BATCH (1 << 20)
+
+static void calculate_regions(const double* a, int na, int maxdinucleotides, int min, int max, char* filename, const char* bedfilename, const char* faifilename, int showprobability, int resume, const char* statusfile)
+{
+    printf("calculating zscore for regions\n");
+
+    char* defaultfai = NULL;
+    if (faifilename == NULL) {
+        defaultfai = (char*)malloc(strlen(filename) + 5);
+        sprintf(defaultfai, "%s.fai", filename);
+        faifilename = defaultfai;
+    }
+    printf("opening %s\n", filename);
+    Reference* reference = reference_open(filename, faifilename);
+    free(defaultfai);
+    if (reference == NULL) {
+        return;
+    }
+
+    size_t nregions;
+    printf("opening %s\n", bedfilename);
+    Region* regions = read_bed(bedfilename, &nregions);
+    if (regions == NULL) {
+        printf("couldn't open %s!\n", bedfilename);
+        reference_close(reference);
         return;
     }
 
@@ -247,111 +1191,325 @@ static void calculate_zscore(double a, int maxdinucleotides, int min, int max, c
         fromdin = todin;
     }
 
+    Output output = { .checkpoint = { .windowsize = maxdinucleotides, .fromdin = fromdin, .todin = todin, .probability = showprobability, .na = na } };
+    memcpy(output.checkpoint.a, a, na * sizeof(double));
+    if (open_output(&output, bedfilename, resume) != 0) {
+        free_regions(regions, nregions);
+        reference_close(reference);
+        return;
+    }
+    FILE* zfile = output.zfile;
+    FILE* pfile = output.pfile;
+
     int nucleotides = 2 * todin;
 
-    fprintf(zfile, "%s %u %d %d\n", filename, seqlength, fromdin, todin);
+    double halfa[na];
+    for (int k = 0; k < na; k++) {
+        halfa[k] = a[k] / 2.0;
+    }
+    antisyn_init();
 
-    a /= 2.0;
-    Result* results = (Result*)calloc(seqlength, sizeof(Result));
+    const FaiEntry** entries = (const FaiEntry**)malloc(nregions * sizeof(FaiEntry*));
+    for (size_t r = 0; r < nregions; r++) {
+        entries[r] = reference_find(reference, regions[r].chrom);
+        if (entries[r] == NULL || regions[r].start >= regions[r].end || regions[r].end > entries[r]->length) {
+            printf("skipping region %s:%zu-%zu\n", regions[r].chrom, regions[r].start, regions[r].end);
+            entries[r] = NULL;
+        }
+    }
 
-    antisyn_init();
+    /* regions before the checkpoint are already written */
+    size_t total = 0, done = 0;
+    for (size_t r = 0; r < nregions; r++) {
+        size_t length = (entries[r] != NULL) ? regions[r].end - regions[r].start : 0;
+        total += length;
+        done += (r < output.checkpoint.record) ? length : 0;
+    }
+    progress_init(&output.progress, total, done, statusfile);
 
     long begintime, endtime;
     time(&begintime);
-    #pragma omp parallel for default(shared)
-    for (unsigned int i = 0; i < seqlength; i++) {
-
-        char bestantisyn[nucleotides + 1];
-        char antisyn[nucleotides + 1];
-        double bzenergy[todin];
-        double dl_logcoef[todin];
-
-        int bzindex[todin];
-        assign_bzenergy_index(nucleotides, sequence + i, bzindex);
-
-        double bestdl = 50.0;
-        int bestdldin = todin;
-        for (int din = fromdin; din <= todin; din++) {
-            find_best_antisyn(din, bzindex, antisyn);
-            antisyn_bzenergy(din, antisyn, bzindex, bzenergy);
-
-            delta_linking_logcoef(din, bzenergy, dl_logcoef);
-            double dl = find_delta_linking(din, a * (double)din, dl_logcoef);
-            if (dl < bestdl) {
-                bestdl = dl;
-                bestdldin = din;
-                strncpy(bestantisyn, antisyn, nucleotides + 1);
+    size_t first = output.checkpoint.record;
+    while (first < nregions && !progress_stopped(&output.progress)) {
+        /* gather regions into a batch, each with its own bases and flank */
+        size_t last = first;
+        size_t batchlength = 0;
+        while (last < nregions) {
+            size_t length = (entries[last] != NULL) ? regions[last].end - regions[last].start : 0;
+            if (last > first && batchlength + length > REGION_BATCH / (size_t)na) {
+                break;
+            }
+            batchlength += length;
+            last++;
+        }
+        size_t count = last - first;
+        size_t* offset = (size_t*)malloc((count + 1) * sizeof(size_t));
+        Sequence** bases = (Sequence**)calloc(count, sizeof(Sequence*));
+        SequenceChunk* chunks = (SequenceChunk*)calloc(count, sizeof(SequenceChunk));
+        offset[0] = 0;
+        for (size_t r = 0; r < count; r++) {
+            const Region* region = &regions[first + r];
+            size_t length = (entries[first + r] != NULL) ? region->end - region->start : 0;
+            offset[r + 1] = offset[r] + length;
+        }
+        #pragma omp parallel for schedule(dynamic)
+        for (size_t r = 0; r < count; r++) {
+            const Region* region = &regions[first + r];
+            size_t length = offset[r + 1] - offset[r];
+            if (length > 0) {
+                INSTRUMENT_BEGIN(PHASE_INDEX);
+                char* text = (char*)malloc(length + nucleotides);
+                reference_fetch(reference, entries[first + r], region->start, region->end, nucleotides, text);
+                bases[r] = sequence_new();
+                sequence_append(bases[r], text, length + nucleotides);
+                free(text);
+                /* skipped non-letters leave the region short, pad it circularly */
+                sequence_finish(bases[r], length + nucleotides - bases[r]->length);
+                sequence_load(bases[r], 0, length + nucleotides, &chunks[r]);
+                INSTRUMENT_END(PHASE_INDEX);
             }
         }
-        antisyn_bzenergy(bestdldin, bestantisyn, bzindex, bzenergy);
-        delta_linking_logcoef(bestdldin, bzenergy, dl_logcoef);
 
-        results[i].dl = bestdl;
-        results[i].slope = atan(delta_linking_slope(bestdl, dl_logcoef, bestdldin)) * pideg;
-        results[i].probability = assign_probability(bestdl);
-        results[i].antisyn = strdup(bestantisyn);
-    }
-    time(&endtime);
+        Result* results = (Result*)calloc(batchlength * na, sizeof(Result));
+        #pragma omp parallel for default(shared) schedule(dynamic, 256)
+        for (size_t i = 0; i < batchlength; i++) {
+            size_t lo = 0, hi = count;
+            while (hi - lo > 1) { /* region containing batch position i */
+                size_t mid = (lo + hi) / 2;
+                if (offset[mid] <= i) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+            while (offset[lo + 1] <= i) {
+                lo++;
+            }
 
-    for (unsigned int i = 0; i < seqlength; ++i) {
-        fprintf(zfile, " %7.3lf %7.3lf %le %s\n", results[i].dl, results[i].slope, results[i].probability, results[i].antisyn);
-        free(results[i].antisyn);
+            Result* result = &results[i * na];
+            for (int k = 0; k < na; k++) {
+                result[k].antisyn = (char*)malloc(nucleotides + 1);
+            }
+            if (sequence_has_gap(bases[lo], i - offset[lo], nucleotides)) {
+                for (int k = 0; k < na; k++) {
+                    no_result(&result[k]);
+                }
+            } else {
+                zscore_window_sweep(sequence_chunk_window(&chunks[lo], i - offset[lo]), halfa, na, fromdin, todin, result);
+            }
+        }
+
+        INSTRUMENT_BEGIN(PHASE_OUTPUT);
+        for (size_t r = 0; r < count; r++) {
+            const Region* region = &regions[first + r];
+            if (offset[r + 1] == offset[r]) {
+                continue;
+            }
+            fprintf(zfile, "%s:%zu-%zu %zu %d %d", region->chrom, region->start + 1, region->end, offset[r + 1] - offset[r], fromdin, todin);
+            write_sweep(zfile, a, na);
+            if (region->name != NULL) {
+                fprintf(zfile, " %s", region->name);
+            }
+            fprintf(zfile, "\n");
+            for (size_t i = offset[r]; i < offset[r + 1]; i++) {
+                write_result(zfile, &results[i * na], na);
+                if (pfile != NULL) {
+                    show_probability(pfile, i - offset[r], bases[r], i - offset[r], &results[i * na]);
+                }
+                for (int k = 0; k < na; k++) {
+                    free(results[i * na + k].antisyn);
+                }
+            }
+            sequence_chunk_free(&chunks[r]);
+            sequence_free(bases[r]);
+        }
+        INSTRUMENT_END(PHASE_OUTPUT);
+        free(results);
+        free(chunks);
+        free(bases);
+        free(offset);
+        first = last;
+        checkpoint_output(&output, first, 0);
+        progress_add(&output.progress, batchlength);
+        progress_report(&output.progress, 0);
     }
-    free(results);
+    time(&endtime);
 
     antisyn_destroy();
-    fclose(zfile);
+    free(entries);
+    close_output(&output);
     printf("\n run time=%ld sec\n", endtime - begintime);
-#ifndef USE_MMAP
-    free(sequence);
-#else
-    munmap(sequence, seqlength);
-    close(sequencefile);
-#endif
+    free_regions(regions, nregions);
+    reference_close(reference);
 }
 
-static void analyze_zscore(char* filename)
+/* windows overlapping ambiguous bases keep their row, with no data */
+static void no_result(Result* result)
 {
-    float *dl, *slope, *probability;
-    unsigned seqlength, i;
-    char** antisyn;
-    FILE* file;
-    int fromdin, todin, nucleotides;
+    result->dl = result->slope = result->probability = NAN;
+    result->antisyn[0] = '\0';
+}
 
-    printf("analyzing_zscore\n");
+/* one row: the scores for each value of the supercoiling parameter */
+static void write_result(FILE* file, const Result* results, int n)
+{
+    for (int k = 0; k < n; k++) {
+        const Result* result = &results[k];
+        if (isnan(result->dl)) {
+            fprintf(file, "     nan     nan nan -");
+        } else {
+            fprintf(file, " %7.3lf %7.3lf %le %s", result->dl, result->slope, result->probability, result->antisyn);
+        }
+    }
+    fprintf(file, "\n");
+}
 
-    file = open_file(1, filename, "Z-SCORE");
-    if (file == NULL) {
-        printf("couldn't open %s.Z-SCORE!\n", filename);
+/* section headers of a sweep list its values, in the order of the column sets */
+static void write_sweep(FILE* file, const double* a, int na)
+{
+    if (na > 1) {
+        fprintf(file, " a=");
+        for (int k = 0; k < na; k++) {
+            fprintf(file, "%s%g", k ? "," : "", a[k]);
+        }
+    }
+}
+
+/* one entry of the probability report: the window's scores, then its bases aligned over the antisyn */
+static void show_probability(FILE* file, size_t i, const Sequence* seq, size_t start, const Result* result)
+{
+    if (isnan(result->dl)) {
         return;
     }
-    fscanf(file, "%s %u %d %d", tempstr, &seqlength, &fromdin, &todin);
-    nucleotides = 2 * todin;
-    dl = (float*)calloc(seqlength, sizeof(float));
-    slope = (float*)calloc(seqlength, sizeof(float));
-    probability = (float*)calloc(seqlength, sizeof(float));
-    antisyn = (char**)calloc(seqlength, sizeof(char*));
+    size_t n = strlen(result->antisyn);
+    char bases[n];
+    sequence_bases(seq, start, n, bases);
+    fprintf(file, " %5zu %7.3f %7.3f  %10.3e  ", i + 1, result->dl, result->slope, result->probability);
+    fwrite(bases, 1, n, file);
+    fprintf(file, "\n                                    %s\n", result->antisyn);
+}
+
+#define TUNE_CHUNK_MIN 1024
+#define TUNE_CHUNK_MAX 16384
+#define TUNE_CHUNKS 4 /* of the largest size per thread, in each trial */
+#define TUNE_REPEATS 2 /* of each trial, the fastest counting */
 
-    for (i = 0; i < seqlength; i++) {
-        fscanf(file, "%f %f %f %s", dl + i, slope + i, probability + i, tempstr);
-        antisyn[i] = strdup(tempstr);
+/* seconds to score 'seq' as things are set now, or 0 if there is nowhere to
+   write the scores */
+static double tune_trial(const Sequence* seq, const double* halfa, int fromdin, int todin)
+{
+    double best = 0.0;
+    for (int r = 0; r < TUNE_REPEATS; r++) {
+        Output output = { .zfile = fopen("/dev/null", "w") };
+        if (output.zfile == NULL) {
+            return 0.0;
+        }
+        progress_init(&output.progress, seq->length, 0, "/dev/null");
+        double start = omp_get_wtime();
+        score_sequence(seq, "tune", halfa, 1, fromdin, todin, 0, 0, &output, NULL);
+        double seconds = omp_get_wtime() - start;
+        fclose(output.zfile);
+        best = (r == 0 || seconds < best) ? seconds : best;
     }
-    fclose(file);
+    return best;
+}
 
-    file = open_file(1, filename, "");
-    input_sequence(file, nucleotides, 0);
-    fclose(file);
+/* the search variants of 'tuning', which all give the same results */
+static void tune_search(const Tuning* tuning)
+{
+    zscore_lanes(tuning->lanes);
+    zscore_incremental(tuning->incremental);
+    antisyn_specialized(tuning->specialized);
+    delta_linking_specialized(tuning->specialized);
+}
 
-    free(dl);
-    free(slope);
-    free(probability);
-    for (i = 0; i < seqlength; i++)
-        free(antisyn[i]);
-    free(antisyn);
-#ifndef USE_MMAP
-    free(sequence);
-#else
-    munmap(sequence, seqlength);
-    close(sequencefile);
-#endif
-}
\ No newline at end of file
+/* Times the search variants on one thread: the lane-parallel conformation
+   search with the coefficients carried from window to window or computed for
+   each, and the one window at a time search, each with the specialized and
+   the generic kernels. Then with the fastest every power of two threads up to
+   the processors, and all of them, each taking chunks of TUNE_CHUNK_MIN up to
+   TUNE_CHUNK_MAX positions. A trial scores TUNE_CHUNKS of the largest chunks
+   per thread of random sequence, to /dev/null; the most bases per second wins
+   and is cached for this host. The direct delta linking isn't tried, as its
+   dl may differ from the factored one's in the last digit. */
+static void calculate_tune(int maxdinucleotides, int min, int max)
+{
+    int todin = (max > maxdinucleotides) ? maxdinucleotides : max;
+    int fromdin = (min > todin) ? todin : min;
+    char host[256];
+    int cores;
+    tune_host(host, sizeof(host), &cores);
+    printf("tuning window sizes %d..%d for %s, %d processors\n", fromdin, todin, host, cores);
+
+    /* the same random bases every time */
+    size_t length = (size_t)TUNE_CHUNKS * cores * TUNE_CHUNK_MAX;
+    char* text = (char*)malloc(length);
+    unsigned state = 1;
+    for (size_t i = 0; i < length; i++) {
+        state = state * 1103515245u + 12345u;
+        text[i] = "acgt"[(state >> 16) & 3];
+    }
+    Sequence* seq = sequence_new();
+    sequence_append(seq, text, length);
+    sequence_finish(seq, 2 * maxdinucleotides);
+    free(text);
+    double halfa = 0.357 / 2.0;
+    antisyn_init();
+
+    Tuning best = { 1, SCORE_CHUNK, 1, 1, 1 };
+    double bestrate = 0.0;
+    printf("%8s %8s %8s %8s %8s %12s\n", "search", "coefs", "kernels", "threads", "chunk", "bases/s");
+    omp_set_num_threads(1);
+    score_chunk = SCORE_CHUNK;
+    Sequence* view = sequence_view(seq->packed, (size_t)TUNE_CHUNKS * TUNE_CHUNK_MAX, 2 * maxdinucleotides);
+    for (int specialized = 1; specialized >= 0; specialized--) {
+        for (int lanes = 1; lanes >= 0; lanes--) {
+            for (int incremental = lanes; incremental >= 0; incremental--) {
+                Tuning trial = { 1, SCORE_CHUNK, lanes, incremental, specialized };
+                tune_search(&trial);
+                double seconds = tune_trial(view, &halfa, fromdin, todin);
+                double rate = (seconds > 0.0) ? view->length / seconds : 0.0;
+                printf("%8s %8s %8s %8d %8zu %12.0f\n", lanes ? "lane" : "scalar", incremental ? "carried" : "full",
+                    specialized ? "special" : "generic", 1, score_chunk, rate);
+                if (rate > bestrate) {
+                    bestrate = rate;
+                    best = trial;
+                }
+            }
+        }
+    }
+    sequence_free(view);
+
+    tune_search(&best);
+    const char* search = best.lanes ? "lane" : "scalar";
+    const char* coefs = best.incremental ? "carried" : "full";
+    const char* kernels = best.specialized ? "special" : "generic";
+    bestrate = 0.0;
+    for (int threads = 1; threads <= cores; threads = (threads < cores && 2 * threads > cores) ? cores : 2 * threads) {
+        view = sequence_view(seq->packed, (size_t)TUNE_CHUNKS * threads * TUNE_CHUNK_MAX, 2 * maxdinucleotides);
+        omp_set_num_threads(threads);
+        for (int chunk = TUNE_CHUNK_MIN; chunk <= TUNE_CHUNK_MAX; chunk *= 4) {
+            score_chunk = chunk;
+            double seconds = tune_trial(view, &halfa, fromdin, todin);
+            double rate = (seconds > 0.0) ? view->length / seconds : 0.0;
+            printf("%8s %8s %8s %8d %8d %12.0f\n", search, coefs, kernels, threads, chunk, rate);
+            if (rate > bestrate) {
+                bestrate = rate;
+                best.threads = threads;
+                best.chunk = chunk;
+            }
+        }
+        sequence_free(view);
+    }
+    antisyn_destroy();
+    sequence_free(seq);
+
+    printf("fastest: %s search, %s coefficients, %s kernels, %d threads, chunks of %d\n", search, coefs, best.specialized ? "specialized" : "generic",
+        best.threads, best.chunk);
+    const char* cachefile = tune_cachefile();
+    if (tune_save(fromdin, todin, &best) != 0) {
+        printf("couldn't write %s!\n", (cachefile != NULL) ? cachefile : "the tuning cache, ZHUNT_TUNE is empty");
+    } else {
+        printf("written to %s\n", cachefile);
+    }
+}
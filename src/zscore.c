@@ -0,0 +1,349 @@
+#include "zscore.h"
+#include "antisyn.h"
+#include "delta_linking.h"
+#include "instrument.h"
+
+#include <math.h>
+#include <string.h>
+
+/* calculate the probability of the value 'dl' in a Gaussian distribution */
+/* from "Data Reduction and Error Analysis for the Physical Science" */
+/* Philip R. Bevington, 1969, McGraw-Hill, Inc */
+
+double assign_probability(double dl)
+{
+    static double average = 29.6537135;
+    static double stdv = 2.71997;
+    static double _sqrt2 = 0.70710678118654752440; /* 1/sqrt(2) */
+    static double _sqrtpi = 0.564189583546; /* 1/sqrt(pi) */
+
+    double x, y, z, k, sum;
+
+    z = fabs(dl - average) / stdv;
+    x = z * _sqrt2;
+    y = _sqrtpi * exp(-x * x);
+    z *= z;
+    k = 1.0;
+    sum = 0.0;
+    do {
+        sum += x;
+        k += 2.0;
+        x *= z / k;
+    } while (sum + x > sum);
+    z = 0.5 - y * sum; /* probability of each tail */
+    return (dl > average) ? z : 1.0 / z;
+}
+
+/* scores the window starting at bzindex ('a' is half the supercoiling parameter);
+   result->antisyn must have room for 2 * todin + 1 characters */
+void zscore_window(const bzindex_t* bzindex, double a, int fromdin, int todin, Result* result)
+{
+    zscore_window_sweep(bzindex, &a, 1, fromdin, todin, result);
+}
+
+/* scores the window for na values of 'a' into results[0..na-1]; the conformations
+   and coefficients don't depend on 'a', only the roots are found once per value */
+void zscore_window_sweep(const bzindex_t* bzindex, const double* a, int na, int fromdin, int todin, Result* results)
+{
+    zscore_window_matrix(bzindex, a, na, fromdin, todin, results, NULL);
+}
+
+static uint32_t pack_antisyn(int dinucleotides, const char* antisyn)
+{
+    uint32_t bits = 0;
+    for (int i = 0; i < dinucleotides; i++) {
+        bits |= (uint32_t)(antisyn[2 * i] == 'S') << i;
+    }
+    return bits;
+}
+
+static void unpack_antisyn(int dinucleotides, uint32_t bits, char* antisyn)
+{
+    for (int i = 0; i < dinucleotides; i++) {
+        antisyn[2 * i] = (bits >> i & 1) ? 'S' : 'A';
+        antisyn[2 * i + 1] = (bits >> i & 1) ? 'A' : 'S';
+    }
+    antisyn[2 * dinucleotides] = '\0';
+}
+
+/* what score_window keeps of each window size's coefficients for the window a
+   dinucleotide on, two windows later in a lane pass */
+typedef struct {
+    uint32_t path[ANTISYN_LANE_DIN + 1];
+    double dropped[ANTISYN_LANE_DIN + 1][2]; /* first two energies */
+    double sums[ANTISYN_LANE_DIN + 1][ANTISYN_LANE_DIN];
+} Carry;
+
+static void score_window(const bzindex_t* bzindex, const double* a, int na, int fromdin, int todin, Result* results, DinScore* scores, const uint32_t* paths, Carry* carry, int shifted);
+
+/* as zscore_window_sweep, and if 'scores' isn't NULL also keeps the root and
+   conformation of every window size 1..todin in scores[k * todin + din - 1] */
+void zscore_window_matrix(const bzindex_t* bzindex, const double* a, int na, int fromdin, int todin, Result* results, DinScore* scores)
+{
+    score_window(bzindex, a, na, fromdin, todin, results, scores, NULL, NULL, 0);
+}
+
+static int lanes = 1;
+
+/* whether zscore_windows searches the conformations of its windows in one
+   lane-parallel pass (the default) or one window at a time; they come out
+   the same either way */
+void zscore_lanes(int enabled)
+{
+    lanes = enabled;
+}
+
+static int incremental = 1;
+
+/* whether the lane-parallel search updates the coefficients of consecutive
+   windows from one to the next (the default) or computes each window's anew;
+   they come out the same either way */
+void zscore_incremental(int enabled)
+{
+    incremental = enabled;
+}
+
+/* zscore_window_matrix for n <= ANTISYN_LANES windows, into results[j * na] and
+   scores[j * na * todin]; their conformations for all window sizes come from a
+   single lane-parallel pass. Where window j + 2 starts a dinucleotide after
+   window j, as consecutive windows of a sequence do, the coefficients of a
+   size whose conformation carries over are updated from window j's rather
+   than recomputed; every pass starts over from exact ones, so no more than
+   ANTISYN_LANES / 2 - 1 updates build on each other. */
+void zscore_windows(const bzindex_t* const* bzindex, int n, const double* a, int na, int fromdin, int todin, Result* results, DinScore* scores)
+{
+    if (todin > ANTISYN_LANE_DIN || !lanes) {
+        for (int j = 0; j < n; j++) {
+            score_window(bzindex[j], a, na, fromdin, todin, &results[j * na], (scores != NULL) ? &scores[j * na * todin] : NULL, NULL, NULL, 0);
+        }
+        return;
+    }
+    uint32_t paths[todin][ANTISYN_LANES];
+    INSTRUMENT_BEGIN(PHASE_DP);
+    find_best_antisyn_lanes(todin, bzindex, n, paths);
+    INSTRUMENT_END(PHASE_DP);
+    Carry carry[2];
+    for (int j = 0; j < n; j++) {
+        int shifted = j >= 2 && bzindex[j] == bzindex[j - 2] + 1;
+        score_window(bzindex[j], a, na, fromdin, todin, &results[j * na], (scores != NULL) ? &scores[j * na * todin] : NULL, &paths[0][j], incremental ? &carry[j & 1] : NULL, shifted);
+    }
+}
+
+/* the conformation of window size din is paths[(din - 1) * ANTISYN_LANES], or
+   searched for if 'paths' is NULL; with 'carry', the coefficients are kept
+   there, and if 'shifted' updated from those it holds of the window a
+   dinucleotide back where the conformation allows */
+static void score_window(const bzindex_t* bzindex, const double* a, int na, int fromdin, int todin, Result* results, DinScore* scores, const uint32_t* paths, Carry* carry, int shifted)
+{
+    static const double pideg = 57.29577951; /* 180/pi */
+
+    char antisyn[todin + 1][2 * todin + 1];
+    double bzenergy[todin];
+    double dl_logcoef[todin + 1][todin];
+
+    double dtwist[na], dl[na], bestdl[na];
+    int bestdldin[na];
+    for (int k = 0; k < na; k++) {
+        bestdl[k] = 50.0;
+        bestdldin[k] = 0;
+    }
+    for (int din = (scores != NULL) ? 1 : fromdin; din <= todin; din++) {
+        INSTRUMENT_BEGIN(PHASE_DP);
+        if (paths != NULL) {
+            antisyn_path_string(din, paths[(din - 1) * ANTISYN_LANES], antisyn[din]);
+        } else {
+            find_best_antisyn(din, bzindex, antisyn[din]);
+        }
+        antisyn_bzenergy(din, antisyn[din], bzindex, bzenergy);
+        INSTRUMENT_END(PHASE_DP);
+
+        INSTRUMENT_BEGIN(PHASE_LOGCOEF);
+        if (carry != NULL) {
+            uint32_t path = paths[(din - 1) * ANTISYN_LANES];
+            if (!shifted || path >> 1 != (carry->path[din] & ((1u << (din - 1)) - 1))
+                || delta_linking_logcoef_shift(din, carry->dropped[din], bzenergy, dl_logcoef[din], carry->sums[din]) != 0) {
+                delta_linking_logcoef_sums(din, bzenergy, dl_logcoef[din], carry->sums[din]);
+            } else {
+                INSTRUMENT_COUNT(COUNTER_LOGCOEF_SHIFT, 1);
+            }
+            carry->path[din] = path;
+            carry->dropped[din][0] = bzenergy[0];
+            carry->dropped[din][1] = (din > 1) ? bzenergy[1] : 1.0;
+        } else {
+            delta_linking_logcoef(din, bzenergy, dl_logcoef[din]);
+        }
+        INSTRUMENT_END(PHASE_LOGCOEF);
+        INSTRUMENT_BEGIN(PHASE_ROOT);
+        for (int k = 0; k < na; k++) {
+            dtwist[k] = a[k] * (double)din;
+        }
+        find_delta_linkings(din, dtwist, na, dl_logcoef[din], dl);
+        INSTRUMENT_END(PHASE_ROOT);
+        if (scores != NULL) {
+            uint32_t bits = pack_antisyn(din, antisyn[din]);
+            for (int k = 0; k < na; k++) {
+                scores[k * todin + din - 1] = (DinScore) { (float)dl[k], bits };
+            }
+            if (din < fromdin) {
+                continue;
+            }
+        }
+        for (int k = 0; k < na; k++) {
+            if (dl[k] < bestdl[k]) {
+                bestdl[k] = dl[k];
+                bestdldin[k] = din;
+            }
+        }
+    }
+
+    INSTRUMENT_BEGIN(PHASE_SLOPE);
+    for (int k = 0; k < na; k++) {
+        int din = bestdldin[k] ? bestdldin[k] : todin; /* no root below 50, report the widest window */
+        strcpy(results[k].antisyn, antisyn[din]);
+        results[k].dl = bestdl[k];
+        results[k].slope = atan(delta_linking_slope(bestdl[k], dl_logcoef[din], din)) * pideg;
+        results[k].probability = assign_probability(bestdl[k]);
+    }
+    INSTRUMENT_END(PHASE_SLOPE);
+    INSTRUMENT_COUNT(COUNTER_WINDOWS, 1);
+}
+
+/* the root for window size din from the energies of its conformation */
+static double size_dl(int din, const double* bzenergy, double a)
+{
+    double logcoef[din];
+    double dtwist = a * (double)din, dl;
+    INSTRUMENT_BEGIN(PHASE_LOGCOEF);
+    delta_linking_logcoef(din, bzenergy, logcoef);
+    INSTRUMENT_END(PHASE_LOGCOEF);
+    INSTRUMENT_BEGIN(PHASE_ROOT);
+    find_delta_linkings(din, &dtwist, 1, logcoef, &dl);
+    INSTRUMENT_END(PHASE_ROOT);
+    return dl;
+}
+
+/* Scores every single base substitution of the window: dl[j][c] is its dl with
+   base j made c (a, t, g, c as 0..3), its own where base j is c already.
+   Changing dinucleotide d leaves the window sizes up to d as they were, so only
+   the wider ones are searched again, carrying on from the window's own DP up
+   to d. A wider size whose conformation and energy at d come out unchanged, or
+   the same as another substitution's at d, keeps that root instead of finding
+   it again. */
+void zscore_window_scan(const bzindex_t* bzindex, double a, int fromdin, int todin, double (*dl)[4])
+{
+    bzindex_t variant[todin];
+    if (todin > ANTISYN_LANE_DIN) {
+        char antisyn[2 * todin + 1];
+        Result result = { .antisyn = antisyn };
+        for (int j = 0; j < 2 * todin; j++) {
+            for (int c = 0; c < 4; c++) {
+                int x = bzindex[j / 2];
+                memcpy(variant, bzindex, todin);
+                variant[j / 2] = (j & 1) ? (x & 12) | c : (c << 2) | (x & 3);
+                score_window(variant, &a, 1, fromdin, todin, &result, NULL, NULL, NULL, 0);
+                dl[j][c] = result.dl;
+            }
+        }
+        return;
+    }
+
+    /* the 3 substitutions of each base of a dinucleotide, 6 per dinucleotide */
+    int n = 6 * todin;
+    int vdin[n];
+    bzindex_t vidx[n];
+    for (int v = 0; v < n; v++) {
+        int d = v / 6, second = v % 6 / 3, x = bzindex[d];
+        int own = second ? (x & 3) : (x >> 2);
+        int c = v % 3 + (v % 3 >= own);
+        vdin[v] = d;
+        vidx[v] = second ? (x & 12) | c : (c << 2) | (x & 3);
+    }
+    uint32_t paths[todin][ANTISYN_LANES], vpaths[n * todin];
+    const bzindex_t* window[ANTISYN_LANES] = { bzindex };
+    INSTRUMENT_BEGIN(PHASE_DP);
+    find_best_antisyn_lanes(todin, window, 1, paths);
+    find_best_antisyn_substituted(todin, bzindex, n, vdin, vidx, vpaths);
+    INSTRUMENT_END(PHASE_DP);
+
+    /* the window itself, every size; best[d] is its best dl over sizes up to d */
+    double energy[todin + 1][todin], sizedl[todin + 1], best[todin + 1];
+    best[0] = 50.0;
+    for (int din = 1; din <= todin; din++) {
+        best[din] = best[din - 1];
+        if (din >= fromdin) {
+            antisyn_path_bzenergy(din, paths[din - 1][0], bzindex, energy[din]);
+            sizedl[din] = size_dl(din, energy[din], a);
+            best[din] = (sizedl[din] < best[din]) ? sizedl[din] : best[din];
+        }
+    }
+    for (int j = 0; j < 2 * todin; j++) {
+        dl[j][(j & 1) ? (bzindex[j / 2] & 3) : (bzindex[j / 2] >> 2)] = best[todin];
+    }
+
+    double bzenergy[6][todin], vsizedl[6], vdl[6];
+    for (int d = 0; d < todin; d++) {
+        for (int k = 0; k < 6; k++) {
+            vdl[k] = best[d];
+        }
+        for (int din = (d + 1 > fromdin) ? d + 1 : fromdin; din <= todin; din++) {
+            for (int k = 0; k < 6; k++) {
+                int v = 6 * d + k;
+                uint32_t path = vpaths[v * todin + din - 1];
+                memcpy(variant, bzindex, todin);
+                variant[d] = vidx[v];
+                INSTRUMENT_BEGIN(PHASE_DP);
+                antisyn_path_bzenergy(din, path, variant, bzenergy[k]);
+                INSTRUMENT_END(PHASE_DP);
+                /* the same conformation and energies give the same root */
+                vsizedl[k] = NAN;
+                if (path == paths[din - 1][0] && bzenergy[k][d] == energy[din][d]) {
+                    vsizedl[k] = sizedl[din];
+                }
+                for (int r = 0; r < k && isnan(vsizedl[k]); r++) {
+                    if (path == vpaths[(v - k + r) * todin + din - 1] && bzenergy[k][d] == bzenergy[r][d]) {
+                        vsizedl[k] = vsizedl[r];
+                    }
+                }
+                if (isnan(vsizedl[k])) {
+                    vsizedl[k] = size_dl(din, bzenergy[k], a);
+                }
+                vdl[k] = (vsizedl[k] < vdl[k]) ? vsizedl[k] : vdl[k];
+            }
+        }
+        for (int k = 0; k < 6; k++) {
+            int second = k / 3, x = bzindex[d];
+            int own = second ? (x & 3) : (x >> 2);
+            dl[2 * d + second][k % 3 + (k % 3 >= own)] = vdl[k];
+        }
+    }
+    INSTRUMENT_COUNT(COUNTER_WINDOWS, 1);
+}
+
+/* Rescores the window for [fromdin,todin] from the roots and conformations of a
+   stored run ('stored' window sizes per value of 'a'): only the winning window
+   size's coefficients are rebuilt, for its slope, there is no search. */
+void zscore_window_query(const bzindex_t* bzindex, const DinScore* scores, int na, int stored, int fromdin, int todin, Result* results)
+{
+    static const double pideg = 57.29577951; /* 180/pi */
+
+    double bzenergy[todin];
+    double logcoef[todin];
+    for (int k = 0; k < na; k++) {
+        const DinScore* score = &scores[k * stored];
+        double bestdl = 50.0;
+        int bestdldin = 0;
+        for (int din = fromdin; din <= todin; din++) {
+            if (score[din - 1].dl < bestdl) {
+                bestdl = score[din - 1].dl;
+                bestdldin = din;
+            }
+        }
+        int din = bestdldin ? bestdldin : todin;
+        unpack_antisyn(din, score[din - 1].antisyn, results[k].antisyn);
+        antisyn_bzenergy(din, results[k].antisyn, bzindex, bzenergy);
+        delta_linking_logcoef(din, bzenergy, logcoef);
+        results[k].dl = bestdl;
+        results[k].slope = atan(delta_linking_slope(bestdl, logcoef, din)) * pideg;
+        results[k].probability = assign_probability(bestdl);
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "antisyn.h"
+
+#include <stdint.h>
+
+typedef struct {
+    double dl;
+    double slope;
+    double probability;
+    char* antisyn;
+} Result;
+
+#define MAX_SWEEP 16 /* values of the supercoiling parameter in one run */
+
+/* what the dl matrix keeps of one window size: its root, which as a bisection
+   point in [10,50] is exact in a float, and its conformation, bit i set when
+   dinucleotide i is SA */
+typedef struct {
+    float dl;
+    uint32_t antisyn;
+} DinScore;
+
+#define MAX_MATRIX_DIN 32
+
+double assign_probability(double dl);
+void zscore_window(const bzindex_t* bzindex, double a, int fromdin, int todin, Result* result);
+void zscore_window_sweep(const bzindex_t* bzindex, const double* a, int na, int fromdin, int todin, Result* results);
+void zscore_window_matrix(const bzindex_t* bzindex, const double* a, int na, int fromdin, int todin, Result* results, DinScore* scores);
+void zscore_lanes(int enabled);
+void zscore_incremental(int enabled);
+void zscore_windows(const bzindex_t* const* bzindex, int n, const double* a, int na, int fromdin, int todin, Result* results, DinScore* scores);
+void zscore_window_scan(const bzindex_t* bzindex, double a, int fromdin, int todin, double (*dl)[4]);
+void zscore_window_query(const bzindex_t* bzindex, const DinScore* scores, int na, int stored, int fromdin, int todin, Result* results);
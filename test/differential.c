@@ -0,0 +1,317 @@
+/*
+Differential check of the fast engine against the exhaustive reference
+(src/mhunt.c): both score the same random and adversarial windows and the
+largest differences and the speedup are reported per window size, along
+with the largest dl difference between the fast engine's factored and direct
+delta linking evaluations, and the windows where the lane-parallel search
+(zscore_windows) picks another conformation or dl than the scalar one, also
+over the consecutive windows of the sequence read circularly, where the
+coefficients carry over from window to window, and the
+substitutions whose dl the scan (zscore_window_scan) gets other than by
+rescoring the changed window, every SCAN_EVERY windows.
+Conformations of equal energy are counted as ties: the two engines break
+them differently (mhunt sums energies as floats in search order) and so may
+legitimately disagree on dl there. Exits with 1 if dl differs by more than
+the tolerance anywhere else or if the lanes or the scan disagree at all.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "antisyn.h"
+#include "delta_linking.h"
+#include "instrument.h"
+#include "mhunt_ref.h"
+#include "zscore.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SCAN_EVERY 8
+
+enum { RANDOM,
+    LOW_COMPLEXITY,
+    REPEAT,
+    MIXED,
+    KINDS };
+
+static const char* kind_names[KINDS] = { "random", "low-complexity", "repeat", "mixed" };
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static unsigned next_random(unsigned* state)
+{
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 16;
+}
+
+/* fills 'seq' with n bases of the given kind; the adversarial ones produce
+   many conformations of equal energy and so exercise the tie-breaking */
+static void generate_window(int kind, char* seq, int n, unsigned* state)
+{
+    static const char bases[] = "atgc";
+    static const char* motifs[] = { "cg", "ca", "tg", "at", "gc", "a", "g", "cgca", "gcac", "tata" };
+    int nmotifs = sizeof(motifs) / sizeof(motifs[0]);
+
+    if (kind == RANDOM) {
+        for (int i = 0; i < n; i++) {
+            seq[i] = bases[next_random(state) & 3];
+        }
+    } else if (kind == LOW_COMPLEXITY) {
+        /* two bases only */
+        char pair[2] = { bases[next_random(state) & 3], bases[next_random(state) & 3] };
+        for (int i = 0; i < n; i++) {
+            seq[i] = pair[next_random(state) & 1];
+        }
+    } else if (kind == REPEAT) {
+        const char* motif = motifs[next_random(state) % nmotifs];
+        int length = strlen(motif), phase = next_random(state) % length;
+        for (int i = 0; i < n; i++) {
+            seq[i] = motif[(i + phase) % length];
+        }
+    } else {
+        /* a repeat broken by random bases */
+        generate_window(REPEAT, seq, n, state);
+        for (int i = 0; i < n; i++) {
+            if ((next_random(state) & 7) == 0) {
+                seq[i] = bases[next_random(state) & 3];
+            }
+        }
+    }
+    seq[n] = '\0';
+}
+
+/* B-Z transition energy of a conformation, kcal/mol */
+static double conformation_energy(int dinucleotides, const char* antisyn, const bzindex_t* bzindex, double* bzenergy)
+{
+    static double rt = 0.59004; /* 0.00198*298 */
+    double esum = 0.0;
+    antisyn_bzenergy(dinucleotides, antisyn, bzindex, bzenergy);
+    for (int i = 0; i < dinucleotides; i++) {
+        esum -= rt * log(bzenergy[i]);
+    }
+    return esum;
+}
+
+static void usage(void)
+{
+    printf("usage: differential [--min din] [--max din] [--windows n] [--seed n] [--tolerance dl]\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option longopts[] = {
+        { "min", required_argument, NULL, 'm' },
+        { "max", required_argument, NULL, 'M' },
+        { "windows", required_argument, NULL, 'w' },
+        { "seed", required_argument, NULL, 's' },
+        { "tolerance", required_argument, NULL, 't' },
+        { NULL, 0, NULL, 0 }
+    };
+    int mindin = 6, maxdin = 12, windows = 200;
+    unsigned seed = 1;
+    double tolerance = 0.001;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'm':
+            mindin = atoi(optarg);
+            break;
+        case 'M':
+            maxdin = atoi(optarg);
+            break;
+        case 'w':
+            windows = atoi(optarg);
+            break;
+        case 's':
+            seed = (unsigned)strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            tolerance = atof(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc || mindin < 1 || maxdin < mindin || windows < 1) {
+        usage();
+    }
+
+    double a = 0.357 / 2.0;
+    int nucleotides = 2 * maxdin;
+    char* seq = (char*)malloc(nucleotides + 1);
+    bzindex_t* bzindex = (bzindex_t*)malloc(maxdin);
+    char* reference_antisyn = (char*)malloc(nucleotides + 1);
+    double* bzenergy = (double*)malloc(maxdin * sizeof(double));
+    double(*scan)[4] = malloc(nucleotides * sizeof(*scan));
+    bzindex_t* substituted = (bzindex_t*)malloc(maxdin);
+    char* circular = (char*)malloc(2 * nucleotides + 1);
+    bzindex_t* frames[2] = { (bzindex_t*)malloc(nucleotides), (bzindex_t*)malloc(nucleotides) };
+    Result consecutive[ANTISYN_LANES];
+    for (int j = 0; j < ANTISYN_LANES; j++) {
+        consecutive[j].antisyn = (char*)malloc(nucleotides + 1);
+    }
+    Result result, direct, lanes, rescored;
+    result.antisyn = (char*)malloc(nucleotides + 1);
+    direct.antisyn = (char*)malloc(nucleotides + 1);
+    lanes.antisyn = (char*)malloc(nucleotides + 1);
+    rescored.antisyn = (char*)malloc(nucleotides + 1);
+
+    antisyn_init();
+    delta_linking_init(maxdin);
+    mhunt_init(maxdin);
+    INSTRUMENT_INIT();
+
+    printf("%4s %-14s %8s %10s %10s %8s %8s %10s %8s %8s %10s %10s %8s\n", "din", "windows", "count", "max_ddl", "max_dslope",
+        "antisyn", "ties", "direct_ddl", "lanes", "scan", "fast_us", "ref_us", "speedup");
+    int failed = 0;
+    for (int din = mindin; din <= maxdin; din++) {
+        int n = 2 * din;
+        for (int kind = 0; kind < KINDS; kind++) {
+            unsigned state = seed * 7919u + din * 31u + kind;
+            double max_ddl = 0.0, max_dslope = 0.0, max_direct = 0.0, fast_time = 0.0, reference_time = 0.0;
+            int mismatches = 0, ties = 0, lane_mismatches = 0, scan_mismatches = 0;
+
+            for (int w = 0; w < windows; w++) {
+                double dl, slope, probability;
+                generate_window(kind, seq, n, &state);
+
+                double t0 = now();
+                assign_bzenergy_index(n, seq, bzindex);
+                zscore_window(bzindex, a, din, din, &result);
+                double t1 = now();
+                mhunt_window(seq, a, din, din, &dl, &slope, &probability, reference_antisyn);
+                double t2 = now();
+                fast_time += t1 - t0;
+                reference_time += t2 - t1;
+
+                delta_linking_method(DELTA_LINKING_DIRECT);
+                zscore_window(bzindex, a, din, din, &direct);
+                delta_linking_method(DELTA_LINKING_FACTORED);
+                double ddirect = fabs(result.dl - direct.dl);
+                if (ddirect > max_direct) {
+                    max_direct = ddirect;
+                }
+                if (ddirect > tolerance) {
+                    if (!failed) {
+                        fprintf(stderr, "first factored/direct mismatch: %s din %d factored %.3f direct %.3f\n", seq, din,
+                            result.dl, direct.dl);
+                    }
+                    failed = 1;
+                }
+
+                const bzindex_t* window = bzindex;
+                zscore_windows(&window, 1, &a, 1, din, din, &lanes, NULL);
+                if (strcmp(lanes.antisyn, result.antisyn) != 0 || lanes.dl != result.dl) {
+                    if (!lane_mismatches && !failed) {
+                        fprintf(stderr, "first lanes mismatch: %s din %d scalar %s lanes %s\n", seq, din, result.antisyn,
+                            lanes.antisyn);
+                    }
+                    lane_mismatches++;
+                    failed = 1;
+                }
+
+                /* window j of the sequence read circularly starts at base j */
+                int nlanes = (n < ANTISYN_LANES) ? n : ANTISYN_LANES;
+                const bzindex_t* windows[ANTISYN_LANES];
+                memcpy(circular, seq, n);
+                memcpy(circular + n, seq, n);
+                assign_bzenergy_index(2 * n, circular, frames[0]);
+                assign_bzenergy_index(2 * n - 2, circular + 1, frames[1]);
+                for (int j = 0; j < nlanes; j++) {
+                    windows[j] = frames[j & 1] + j / 2;
+                }
+                zscore_windows(windows, nlanes, &a, 1, din, din, consecutive, NULL);
+                for (int j = 0; w % SCAN_EVERY == 0 && j < nlanes; j++) {
+                    zscore_window(windows[j], a, din, din, &rescored);
+                    if (strcmp(consecutive[j].antisyn, rescored.antisyn) != 0 || consecutive[j].dl != rescored.dl) {
+                        if (!lane_mismatches && !failed) {
+                            fprintf(stderr, "first consecutive lanes mismatch: %s din %d window %d scalar %s lanes %s\n", seq, din,
+                                j, rescored.antisyn, consecutive[j].antisyn);
+                        }
+                        lane_mismatches++;
+                        failed = 1;
+                    }
+                }
+
+                /* every window size up to din, so that the narrower ones are reused */
+                for (int j = 0; w % SCAN_EVERY == 0 && j < n; j++) {
+                    if (j == 0) {
+                        zscore_window_scan(bzindex, a, 1, din, scan);
+                    }
+                    for (int c = 0; c < 4; c++) {
+                        int x = bzindex[j / 2];
+                        memcpy(substituted, bzindex, din);
+                        substituted[j / 2] = (j & 1) ? (x & 12) | c : (c << 2) | (x & 3);
+                        zscore_window(substituted, a, 1, din, &rescored);
+                        if (rescored.dl != scan[j][c]) {
+                            if (!scan_mismatches && !failed) {
+                                fprintf(stderr, "first scan mismatch: %s din %d base %d to %c scan %.3f rescored %.3f\n", seq, din, j,
+                                    "atgc"[c], scan[j][c], rescored.dl);
+                            }
+                            scan_mismatches++;
+                            failed = 1;
+                        }
+                    }
+                }
+
+                double ddl = fabs(result.dl - dl), dslope = fabs(result.slope - slope);
+                if (ddl > max_ddl) {
+                    max_ddl = ddl;
+                }
+                if (dslope > max_dslope) {
+                    max_dslope = dslope;
+                }
+                int tie = 0;
+                if (strcmp(result.antisyn, reference_antisyn) != 0) {
+                    mismatches++;
+                    double fast_energy = conformation_energy(din, result.antisyn, bzindex, bzenergy);
+                    double reference_energy = conformation_energy(din, reference_antisyn, bzindex, bzenergy);
+                    tie = fabs(fast_energy - reference_energy) < 1e-6;
+                    ties += tie;
+                }
+                if (ddl > tolerance && !tie) {
+                    if (!failed) {
+                        fprintf(stderr, "first dl mismatch: %s din %d fast %.3f %s reference %.3f %s\n", seq, din,
+                            result.dl, result.antisyn, dl, reference_antisyn);
+                    }
+                    failed = 1;
+                }
+            }
+            printf("%4d %-14s %8d %10.3g %10.3g %8d %8d %10.3g %8d %8d %10.3f %10.3f %8.1f\n", din, kind_names[kind], windows,
+                max_ddl, max_dslope, mismatches, ties, max_direct, lane_mismatches, scan_mismatches, fast_time / windows * 1e6, reference_time / windows * 1e6,
+                reference_time / fast_time);
+        }
+    }
+
+    mhunt_destroy();
+    delta_linking_destroy();
+    antisyn_destroy();
+    free(result.antisyn);
+    free(direct.antisyn);
+    free(lanes.antisyn);
+    free(rescored.antisyn);
+    free(substituted);
+    free(circular);
+    free(frames[0]);
+    free(frames[1]);
+    for (int j = 0; j < ANTISYN_LANES; j++) {
+        free(consecutive[j].antisyn);
+    }
+    free(scan);
+    free(bzenergy);
+    free(reference_antisyn);
+    free(bzindex);
+    free(seq);
+    INSTRUMENT_DUMP();
+    return failed;
+}
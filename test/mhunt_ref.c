@@ -0,0 +1,109 @@
+/*
+The original exhaustive Z-Hunt (src/mhunt.c) built as a library, as the
+reference the fast engine is checked against. Its globals and functions are
+renamed where they clash with the fast engine and its main() is left unused;
+mhunt_init() does the allocations main() used to.
+*/
+
+#define main mhunt_main
+#define assign_bzenergy_index mhunt_assign_bzenergy_index
+#define assign_probability mhunt_assign_probability
+#define delta_linking_slope mhunt_delta_linking_slope
+#define find_delta_linking mhunt_find_delta_linking
+#define calculate_zscore mhunt_calculate_zscore
+#define analyze_zscore mhunt_analyze_zscore
+#define input_sequence mhunt_input_sequence
+#define open_file mhunt_open_file
+#define gets(s) fgets(s, 128, stdin)
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wunused-result"
+#pragma GCC diagnostic ignored "-Wsign-compare"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wdiscarded-qualifiers"
+#pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
+#include "../src/mhunt.c"
+#pragma GCC diagnostic pop
+
+#include "mhunt_ref.h"
+
+void mhunt_init(int max_dinucleotides)
+{
+    static double rt = 0.59004; /* 0.00198*298 */
+    static double a = 0.357, b = 0.4; /* a = 2 * (1/10.5 + 1/12) */
+    int nucleotides = 2 * max_dinucleotides;
+
+    antisyn = (char*)malloc(nucleotides + 1);
+    best_antisyn = (char*)malloc(nucleotides + 1);
+    bzindex = (int*)calloc(max_dinucleotides, sizeof(int));
+    bzenergy = (double*)calloc(max_dinucleotides, sizeof(double));
+    best_bzenergy = (double*)calloc(max_dinucleotides, sizeof(double));
+
+    bztwist = (double*)calloc(max_dinucleotides, sizeof(double));
+    double ab = b + b;
+    for (int i = 0; i < max_dinucleotides; i++) {
+        ab += a;
+        bztwist[i] = ab;
+    }
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 25; j++) {
+            expdbzed[i][j] = exp(-dbzed[i][j] / rt);
+        }
+    }
+    logcoef = (double*)calloc(max_dinucleotides, sizeof(double));
+    exponent = (double*)calloc(max_dinucleotides, sizeof(double));
+}
+
+void mhunt_destroy(void)
+{
+    free(exponent);
+    free(logcoef);
+    free(bztwist);
+    free(best_bzenergy);
+    free(bzenergy);
+    free(bzindex);
+    free(best_antisyn);
+    free(antisyn);
+}
+
+/* the body of mhunt's calculate_zscore() loop for the window at 'seq' ('a' is
+   already halved); mhunt takes the slope from the coefficients of the last din
+   tried, here they are recomputed for the best din as the fast engine does */
+void mhunt_window(const char* seq, double a, int fromdin, int todin, double* dl, double* slope, double* probability, char* antisyn_out)
+{
+    static double pideg = 57.29577951; /* 180/pi */
+    float initesum = 10.0 * todin;
+    double bestdl = 50.0;
+    int bestdin = todin;
+
+    assign_bzenergy_index(2 * todin, (char*)seq);
+    antisyn_out[0] = '\0';
+    for (int din = fromdin; din <= todin; din++) {
+        best_esum = initesum;
+        deltatwist = a * (double)din;
+        antisyn[2 * din] = 0;
+        anti_syn_energy(0, din, 0.0);
+        double d = find_delta_linking(din);
+        if (d < bestdl) {
+            bestdl = d;
+            bestdin = din;
+            strcpy(antisyn_out, best_antisyn);
+        }
+    }
+    if (antisyn_out[0] == '\0') {
+        strcpy(antisyn_out, best_antisyn);
+    }
+
+    best_esum = initesum;
+    deltatwist = a * (double)bestdin;
+    antisyn[2 * bestdin] = 0;
+    anti_syn_energy(0, bestdin, 0.0);
+    find_delta_linking(bestdin);
+
+    *dl = bestdl;
+    *slope = atan(delta_linking_slope(bestdl)) * pideg;
+    *probability = assign_probability(bestdl);
+}
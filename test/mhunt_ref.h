@@ -0,0 +1,5 @@
+#pragma once
+
+void mhunt_init(int max_dinucleotides);
+void mhunt_destroy(void);
+void mhunt_window(const char* seq, double a, int fromdin, int todin, double* dl, double* slope, double* probability, char* antisyn_out);
@@ -0,0 +1,400 @@
+/*
+Round trip of the bedGraph/bigWig writer (src/track.c): a track over a few
+hundred chromosomes, one of them long enough to take a second level of data
+blocks in the R-tree and enough of them for a second level in the chromosome
+tree, is written and read back by the independent reader below, following
+the tree and index offsets from the header as a genome browser does. The
+intervals must come back exactly as they were added, in order, as must the
+bedGraph lines, and the zoom levels and the total summary must add up to them.
+Exits with 1 at the first difference.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "track.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define CHROMS 300
+#define LONG_CHROM 7 /* the one with more than 256 data blocks */
+#define LONG_LENGTH 700000
+
+typedef struct {
+    uint32_t chrom;
+    uint32_t start;
+    uint32_t end;
+    float value;
+} Interval;
+
+static unsigned char* data;
+static size_t size;
+static int failed;
+
+static void fail(const char* what)
+{
+    if (!failed) {
+        fprintf(stderr, "track check failed: %s\n", what);
+    }
+    failed = 1;
+}
+
+static uint16_t get16(uint64_t offset)
+{
+    uint16_t v = 0;
+    if (offset + sizeof(v) <= size) {
+        memcpy(&v, data + offset, sizeof(v));
+    } else {
+        fail("read past the end of the file");
+    }
+    return v;
+}
+
+static uint32_t get32(uint64_t offset)
+{
+    uint32_t v = 0;
+    if (offset + sizeof(v) <= size) {
+        memcpy(&v, data + offset, sizeof(v));
+    } else {
+        fail("read past the end of the file");
+    }
+    return v;
+}
+
+static uint64_t get64(uint64_t offset)
+{
+    uint64_t v = 0;
+    if (offset + sizeof(v) <= size) {
+        memcpy(&v, data + offset, sizeof(v));
+    } else {
+        fail("read past the end of the file");
+    }
+    return v;
+}
+
+static float getfloat(const unsigned char* p)
+{
+    float v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static double getdouble(uint64_t offset)
+{
+    double v = 0.0;
+    if (offset + sizeof(v) <= size) {
+        memcpy(&v, data + offset, sizeof(v));
+    }
+    return v;
+}
+
+static unsigned next_random(unsigned* state)
+{
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 16;
+}
+
+/* (chrom, base) as one ordered key */
+static uint64_t position(uint32_t chrom, uint32_t base)
+{
+    return (uint64_t)chrom << 32 | base;
+}
+
+/* descends the chromosome tree for 'name', returning its id or -1 */
+static int64_t find_chrom(uint64_t tree, const char* name, uint32_t* chromsize)
+{
+    uint32_t keysize = get32(tree + 8);
+    char key[256];
+    if (keysize >= sizeof(key) || strlen(name) > keysize) {
+        return -1;
+    }
+    memset(key, 0, sizeof(key));
+    memcpy(key, name, strlen(name));
+    uint64_t node = tree + 32;
+    for (int depth = 0; depth < 8 && !failed; depth++) {
+        int leaf = data[node];
+        uint16_t count = get16(node + 2);
+        size_t slot = keysize + 8;
+        if (leaf) {
+            for (uint16_t i = 0; i < count; i++) {
+                uint64_t item = node + 4 + i * slot;
+                if (memcmp(data + item, key, keysize) == 0) {
+                    *chromsize = get32(item + keysize + 4);
+                    return get32(item + keysize);
+                }
+            }
+            return -1;
+        }
+        /* the last child whose first key is not after the name */
+        uint64_t child = 0;
+        for (uint16_t i = 0; i < count; i++) {
+            uint64_t item = node + 4 + i * slot;
+            if (i == 0 || memcmp(data + item, key, keysize) <= 0) {
+                child = get64(item + keysize);
+            }
+        }
+        node = child;
+    }
+    return -1;
+}
+
+/* the leaves of an R-tree in order into blocks[2 * k] (offset) and
+   blocks[2 * k + 1] (size), checking that every node's entries lie within
+   the bounds its parent gave it; returns the number of leaves */
+static size_t rtree_leaves(uint64_t node, uint64_t low, uint64_t high, uint64_t* blocks, size_t n, size_t capacity, int depth)
+{
+    if (depth > 8 || node + 4 > size) {
+        fail("R-tree node out of the file");
+        return n;
+    }
+    int leaf = data[node];
+    uint16_t count = get16(node + 2);
+    for (uint16_t i = 0; i < count && !failed; i++) {
+        uint64_t item = node + 4 + i * (leaf ? 32 : 24);
+        uint64_t start = position(get32(item), get32(item + 4));
+        uint64_t end = position(get32(item + 8), get32(item + 12));
+        if (start < low || end > high || start > end) {
+            fail("R-tree entry outside its parent's bounds");
+        }
+        if (leaf) {
+            if (n == capacity) {
+                fail("more R-tree leaves than blocks");
+                return n;
+            }
+            blocks[2 * n] = get64(item + 16);
+            blocks[2 * n + 1] = get64(item + 24);
+            n++;
+        } else {
+            n = rtree_leaves(get64(item + 16), start, end, blocks, n, capacity, depth + 1);
+        }
+    }
+    return n;
+}
+
+/* the leaves of the R-tree at 'index', with its header checked */
+static size_t read_rtree(uint64_t index, uint64_t** blocks)
+{
+    if (get32(index) != 0x2468ACE0) {
+        fail("bad R-tree magic");
+        return 0;
+    }
+    uint64_t count = get64(index + 8);
+    uint64_t low = position(get32(index + 16), get32(index + 20));
+    uint64_t high = position(get32(index + 24), get32(index + 28));
+    *blocks = (uint64_t*)malloc((2 * count + 2) * sizeof(uint64_t));
+    size_t n = rtree_leaves(index + 48, low, high, *blocks, 0, count, 0);
+    if (n != count) {
+        fail("R-tree leaves differ from its item count");
+    }
+    return n;
+}
+
+/* inflates a block into 'out', returning its size */
+static uLongf inflate_block(uint64_t offset, uint64_t compressed, unsigned char* out, uLongf capacity)
+{
+    if (offset + compressed > size || uncompress(out, &capacity, data + offset, compressed) != Z_OK) {
+        fail("a block doesn't inflate");
+        return 0;
+    }
+    return capacity;
+}
+
+int main(void)
+{
+    const char* bigwigfile = "track_check.bw";
+    const char* bedgraphfile = "track_check.bedGraph";
+
+    /* values from a few levels so that runs form, with gaps */
+    Track* track = track_open(bedgraphfile, bigwigfile);
+    if (track == NULL) {
+        printf("couldn't open %s!\n", bigwigfile);
+        return 1;
+    }
+    size_t capacity = 1 << 20, nintervals = 0;
+    Interval* intervals = (Interval*)malloc(capacity * sizeof(Interval));
+    char name[32];
+    uint32_t lengths[CHROMS];
+    unsigned state = 1;
+    double sum = 0.0;
+    uint64_t covered = 0;
+    for (uint32_t c = 0; c < CHROMS; c++) {
+        lengths[c] = (c == LONG_CHROM) ? LONG_LENGTH : 1 + next_random(&state) % 3000;
+        sprintf(name, "chr%u", c);
+        track_begin(track, name, lengths[c]);
+        int inrun = 0;
+        for (uint32_t i = 0; i < lengths[c]; i++) {
+            unsigned r = next_random(&state) % 16;
+            double value = (r == 0) ? NAN : (r % 4) * 0.25 + 1e-3 * (c % 3);
+            track_add(track, i, value);
+            if (isnan(value)) {
+                inrun = 0;
+                continue;
+            }
+            sum += (float)value;
+            covered++;
+            if (inrun && intervals[nintervals - 1].value == (float)value) {
+                intervals[nintervals - 1].end++;
+                continue;
+            }
+            if (nintervals == capacity) {
+                capacity *= 2;
+                intervals = (Interval*)realloc(intervals, capacity * sizeof(Interval));
+            }
+            intervals[nintervals++] = (Interval) { c, i, i + 1, (float)value };
+            inrun = 1;
+        }
+    }
+    if (track_close(track) != 0) {
+        printf("couldn't write %s!\n", bigwigfile);
+        return 1;
+    }
+
+    /* the bedGraph, line by line */
+    FILE* file = fopen(bedgraphfile, "r");
+    size_t lines = 0;
+    char line[256], expected[256];
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL && !failed) {
+        const Interval* v = &intervals[lines];
+        snprintf(expected, sizeof(expected), "chr%u\t%u\t%u\t%g\n", v->chrom, v->start, v->end, v->value);
+        if (lines >= nintervals || strcmp(line, expected) != 0) {
+            fail("a bedGraph line differs");
+        }
+        lines++;
+    }
+    if (file == NULL || lines != nintervals) {
+        fail("the bedGraph has other than one line per interval");
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+
+    file = fopen(bigwigfile, "rb");
+    if (file == NULL) {
+        printf("couldn't read %s!\n", bigwigfile);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+    data = (unsigned char*)malloc(size);
+    if (fread(data, 1, size, file) != size) {
+        fail("short read");
+    }
+    fclose(file);
+
+    if (get32(0) != 0x888FFC26 || get32(size - 4) != 0x888FFC26 || get16(4) != 4) {
+        fail("bad bigWig magic or version");
+    }
+    uint16_t nzooms = get16(6);
+    uint64_t chromtree = get64(8), fulldata = get64(16), fullindex = get64(24);
+    uint64_t totalsummary = get64(44);
+    uint32_t buffersize = get32(52);
+
+    /* every chromosome found by descending its tree, with its size */
+    if (get32(chromtree) != 0x78CA8C91 || get64(chromtree + 16) != CHROMS) {
+        fail("bad chromosome tree header");
+    }
+    for (uint32_t c = 0; c < CHROMS && !failed; c++) {
+        uint32_t chromsize = 0;
+        sprintf(name, "chr%u", c);
+        if (find_chrom(chromtree, name, &chromsize) != c || chromsize != lengths[c]) {
+            fail("a chromosome isn't found in the tree");
+        }
+    }
+    uint32_t missing;
+    if (find_chrom(chromtree, "chrX", &missing) != -1) {
+        fail("the tree finds a chromosome that isn't there");
+    }
+
+    /* the data blocks through the R-tree, in order */
+    uint64_t* blocks;
+    size_t nblocks = read_rtree(fullindex, &blocks);
+    if (get64(fulldata) != nblocks) {
+        fail("the data block count differs from the index");
+    }
+    if (nblocks <= 256) {
+        fail("too few data blocks for a second R-tree level");
+    }
+    unsigned char* block = (unsigned char*)malloc(buffersize);
+    size_t k = 0;
+    for (size_t b = 0; b < nblocks && !failed; b++) {
+        uLongf n = inflate_block(blocks[2 * b], blocks[2 * b + 1], block, buffersize);
+        uint32_t chrom, start, end;
+        memcpy(&chrom, block, 4);
+        memcpy(&start, block + 4, 4);
+        memcpy(&end, block + 8, 4);
+        uint16_t count;
+        memcpy(&count, block + 22, 2);
+        if (block[20] != 1 || n != 24 + 12u * count) {
+            fail("a data block isn't a bedGraph section");
+            break;
+        }
+        for (uint16_t i = 0; i < count && !failed; i++, k++) {
+            uint32_t s, e;
+            memcpy(&s, block + 24 + 12 * i, 4);
+            memcpy(&e, block + 28 + 12 * i, 4);
+            float value = getfloat(block + 32 + 12 * i);
+            const Interval* v = &intervals[k];
+            if (k >= nintervals || v->chrom != chrom || v->start != s || v->end != e || v->value != value || s < start || e > end) {
+                fail("a bigWig interval differs");
+            }
+        }
+    }
+    if (!failed && k != nintervals) {
+        fail("the bigWig has other intervals than were added");
+    }
+    free(blocks);
+
+    /* each zoom level covers the same bases with the same sum */
+    for (int z = 0; z < nzooms && !failed; z++) {
+        uint64_t header = 64 + 24 * z;
+        uint32_t reduction = get32(header);
+        uint64_t zoomdata = get64(header + 8), zoomindex = get64(header + 16);
+        size_t nzoomblocks = read_rtree(zoomindex, &blocks);
+        uint64_t zoomcovered = 0, records = 0, previous = 0;
+        double zoomsum = 0.0;
+        for (size_t b = 0; b < nzoomblocks && !failed; b++) {
+            uLongf n = inflate_block(blocks[2 * b], blocks[2 * b + 1], block, buffersize);
+            for (uLongf r = 0; r + 32 <= n; r += 32, records++) {
+                uint32_t chrom, start, end, count;
+                memcpy(&chrom, block + r, 4);
+                memcpy(&start, block + r + 4, 4);
+                memcpy(&end, block + r + 8, 4);
+                memcpy(&count, block + r + 12, 4);
+                if (end - start > reduction || count > end - start || position(chrom, start) < previous) {
+                    fail("a zoom record is out of order or too wide");
+                }
+                previous = position(chrom, end);
+                zoomcovered += count;
+                zoomsum += getfloat(block + r + 24);
+            }
+        }
+        if (get32(zoomdata) != records) {
+            fail("a zoom level's record count differs");
+        }
+        if (zoomcovered != covered || fabs(zoomsum - sum) > 1e-4 * sum) {
+            fail("a zoom level doesn't add up to the intervals");
+        }
+        free(blocks);
+    }
+    if (nzooms == 0) {
+        fail("no zoom levels");
+    }
+    if (get64(totalsummary) != covered || fabs(getdouble(totalsummary + 24) - sum) > 1e-6 * sum) {
+        fail("the total summary doesn't add up to the intervals");
+    }
+
+    printf("track: %u chromosomes, %zu intervals, %zu data blocks, %d zoom levels: %s\n", CHROMS, nintervals, nblocks, nzooms,
+        failed ? "FAILED" : "ok");
+    free(block);
+    free(data);
+    free(intervals);
+    unlink(bigwigfile);
+    unlink(bedgraphfile);
+    return failed;
+}
@@ -0,0 +1,24 @@
+#!/bin/sh
+# The clusters zhunt --vcf makes of the variants in test/data: phased and
+# unphased genotypes, missing alleles, multi-allelic sites, overlapping alleles
+# of one haplotype, a change of chromosome and a VCF without samples. Only the
+# columns up to the carriers are compared, the scores are checked elsewhere.
+# usage: vcf_check.sh zhunt test/data
+zhunt=$1
+data=$2
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+status=0
+for vcf in variants.vcf variants_nosamples.vcf; do
+    cp "$data/$vcf" "$work/$vcf"
+    if ! "$zhunt" --vcf "$work/$vcf" 12 6 12 "$data/variants.fasta" > "$work/log"; then
+        cat "$work/log"
+        status=1
+    elif cut -f1-6 "$work/$vcf.Z-DELTA" | diff "$data/$vcf.CLUSTERS" -; then
+        echo "vcf: $vcf ok"
+    else
+        echo "vcf: $vcf FAILED"
+        status=1
+    fi
+done
+exit $status
@@ -0,0 +1,64 @@
+"""Reader for the summary tiles that `zhunt --tiles` writes.
+
+The file holds, for each sequence, the minimum, maximum and mean dl and
+probability over bins of 16, 32, 64, ... bases up to a single bin for the
+whole sequence, and a directory at its end (see src/tiles.h). A range is
+served from the finest level that covers it in at most the bins asked for,
+reading only those bins, so whole chromosomes plot as fast as a few kb.
+"""
+import math
+import struct
+
+MAGIC = b'ZHTILES1'
+BIN = struct.Struct('=6fI')
+STATS = ['min', 'max', 'mean']
+
+
+def read_directory(path):
+    """The sections of a tiles file: name, length and (offset, bins, size) per level."""
+    with open(path, 'rb') as f:
+        if f.read(len(MAGIC)) != MAGIC:
+            raise ValueError('not a tiles file')
+        f.seek(-8, 2)
+        f.seek(struct.unpack('=Q', f.read(8))[0])
+        sections = []
+        for _ in range(struct.unpack('=I', f.read(4))[0]):
+            name = f.read(struct.unpack('=I', f.read(4))[0]).decode()
+            length, shift, nlevels = struct.unpack('=QII', f.read(16))
+            levels = []
+            for k in range(nlevels):
+                offset, nbins = struct.unpack('=QQ', f.read(16))
+                levels.append((offset, nbins, 1 << (shift + k)))
+            sections.append({'name': name, 'length': length, 'levels': levels})
+        return sections
+
+
+def read_tiles(path, start=0, end=None, bins=1000, section=0):
+    """The bins over [start, end) of a section at the finest level with at most `bins` of them."""
+    sections = read_directory(path)
+    if not 0 <= section < len(sections):
+        raise IndexError('no section %d' % section)
+    length = sections[section]['length']
+    end = length if end is None else min(end, length)
+    start = max(0, min(start, end))
+    levels = sections[section]['levels']
+    offset, nbins, size = levels[-1]
+    for level in levels:
+        if math.ceil((end - start) / level[2]) <= bins:
+            offset, nbins, size = level
+            break
+    first = start // size
+    last = min(nbins, max(first + 1, -(-end // size)))
+    tiles = {'name': sections[section]['name'], 'length': length, 'size': size,
+             'start': [], 'count': [], 'dl': {s: [] for s in STATS}, 'probability': {s: [] for s in STATS}}
+    with open(path, 'rb') as f:
+        f.seek(offset + first * BIN.size)
+        data = f.read((last - first) * BIN.size)
+    for i, values in enumerate(BIN.iter_unpack(data)):
+        tiles['start'].append((first + i) * size)
+        tiles['count'].append(values[6])
+        for v, score in enumerate(['dl', 'probability']):
+            for s, stat in enumerate(STATS):
+                value = values[3 * v + s]
+                tiles[score][stat].append(None if math.isnan(value) else value)
+    return tiles